@@ -0,0 +1,221 @@
+// Criterion benchmarks for the C API. The library is only built as a
+// staticlib/cdylib, so the FFI layer is pulled in as a module and its
+// functions are called exactly like a C client would call them.
+
+#[path = "../src/lib.rs"]
+#[allow(dead_code)]
+mod ffi;
+
+use criterion::{
+    black_box, criterion_group, criterion_main, Criterion, Throughput,
+};
+use std::ffi::CString;
+use std::os::raw::c_char;
+use std::ptr;
+use std::sync::RwLock;
+use webthing::{Action, Property, Thing};
+
+const LEVEL_METADATA: &str =
+    "{\"type\":\"number\",\"minimum\":0,\"maximum\":100,\"unit\":\"percent\"}";
+
+macro_rules! cstr {
+    ( $v:expr ) => {
+        CString::new($v).unwrap()
+    };
+}
+
+extern "C" fn noop_perform(
+    _thing: *const RwLock<Box<dyn Thing>>,
+    _action_name: *const c_char,
+    _action_id: *const c_char,
+) {
+}
+
+fn make_thing(properties: usize) -> *mut Box<dyn Thing> {
+    let id = cstr!("urn:dev:ops:bench-1234");
+    let title = cstr!("Bench");
+    let thing = ffi::webthing_thing_new(
+        id.as_ptr(),
+        title.as_ptr(),
+        ptr::null(),
+        ptr::null(),
+    );
+    let metadata = cstr!(LEVEL_METADATA);
+    let initial = cstr!("0");
+    for i in 0..properties {
+        let name =
+            if i == 0 { cstr!("level") } else { cstr!(format!("level{}", i)) };
+        let property = ffi::webthing_property_new(
+            name.as_ptr() as *mut c_char,
+            initial.as_ptr() as *mut c_char,
+            ptr::null_mut(),
+            metadata.as_ptr() as *mut c_char,
+        );
+        ffi::webthing_thing_add_property(
+            thing,
+            property as *mut Box<dyn Property>,
+        );
+    }
+    thing
+}
+
+fn properties(c: &mut Criterion) {
+    let thing = make_thing(1);
+    let name = cstr!("level");
+    let value = cstr!("42");
+
+    c.bench_function("webthing_thing_set_property", |b| {
+        b.iter(|| {
+            let err = ffi::webthing_thing_set_property(
+                thing,
+                name.as_ptr() as *mut c_char,
+                value.as_ptr() as *mut c_char,
+            );
+            black_box(err);
+        })
+    });
+
+    c.bench_function("webthing_thing_get_property", |b| {
+        b.iter(|| {
+            let value = ffi::webthing_thing_get_property(
+                thing,
+                name.as_ptr() as *mut c_char,
+            );
+            ffi::webthing_str_free(black_box(value) as *mut c_char);
+        })
+    });
+
+    c.bench_function("webthing_thing_property_notify", |b| {
+        b.iter(|| {
+            ffi::webthing_thing_property_notify(
+                thing,
+                name.as_ptr() as *mut c_char,
+                value.as_ptr() as *mut c_char,
+            );
+        })
+    });
+
+    ffi::webthing_thing_free(thing);
+}
+
+fn locks(c: &mut Criterion) {
+    let lock = ffi::webthing_thing_lock_new(make_thing(1)) as *mut RwLock<_>;
+
+    c.bench_function("webthing_thing_lock_read", |b| {
+        b.iter(|| {
+            let guard = ffi::webthing_thing_lock_read(lock);
+            ffi::webthing_thing_unlock_read(black_box(guard) as *mut _);
+        })
+    });
+
+    c.bench_function("webthing_thing_lock_write", |b| {
+        b.iter(|| {
+            let guard = ffi::webthing_thing_lock_write(lock);
+            ffi::webthing_thing_unlock_write(black_box(guard) as *mut _);
+        })
+    });
+
+    ffi::webthing_thing_lock_free(lock);
+}
+
+fn thing_description(c: &mut Criterion) {
+    let thing = make_thing(50);
+
+    c.bench_function("webthing_thing_as_thing_description", |b| {
+        b.iter(|| {
+            let td = ffi::webthing_thing_as_thing_description(thing);
+            ffi::webthing_str_free(black_box(td) as *mut c_char);
+        })
+    });
+
+    ffi::webthing_thing_free(thing);
+}
+
+// Float-heavy properties, as reported by a typical sensor. Readings of a
+// sensor with a binary resolution, e.g. 1/16 degree, fit single precision
+// floats in CBOR; decimal readings like 21.437 need double precision.
+fn encodings(c: &mut Criterion) {
+    encoding("binary", c, |i| 21.0 + i as f64 / 16.0);
+    encoding("decimal", c, |i| (21000 + 37 * i) as f64 / 1000.0);
+}
+
+fn encoding(label: &str, c: &mut Criterion, reading: fn(usize) -> f64) {
+    let thing = make_thing(50);
+    for i in 1..50 {
+        let name = cstr!(format!("level{}", i));
+        let value = cstr!(reading(i).to_string());
+        ffi::webthing_thing_set_property(
+            thing,
+            name.as_ptr() as *mut c_char,
+            value.as_ptr() as *mut c_char,
+        );
+    }
+    let json = ffi::webthing_thing_get_properties(thing);
+    let json_len = unsafe { std::ffi::CStr::from_ptr(json) }.to_bytes().len();
+    ffi::webthing_str_free(json as *mut c_char);
+    let cbor_len =
+        ffi::webthing_thing_get_properties_cbor(thing, ptr::null_mut(), 0)
+            as usize;
+    println!(
+        "properties ({} readings): {} bytes JSON, {} bytes CBOR",
+        label, json_len, cbor_len
+    );
+    let mut buf = vec![0u8; cbor_len];
+
+    let mut group = c.benchmark_group(format!("properties/{}", label));
+    group.throughput(Throughput::Bytes(json_len as u64));
+    group.bench_function("json", |b| {
+        b.iter(|| {
+            let json = ffi::webthing_thing_get_properties(thing);
+            ffi::webthing_str_free(black_box(json) as *mut c_char);
+        })
+    });
+    group.throughput(Throughput::Bytes(cbor_len as u64));
+    group.bench_function("cbor", |b| {
+        b.iter(|| {
+            black_box(ffi::webthing_thing_get_properties_cbor(
+                thing,
+                buf.as_mut_ptr(),
+                buf.len(),
+            ));
+        })
+    });
+    group.finish();
+
+    ffi::webthing_thing_free(thing);
+}
+
+fn actions(c: &mut Criterion) {
+    let lock = ffi::webthing_thing_lock_new(make_thing(1)) as *mut RwLock<_>;
+    let id = cstr!("bench-action");
+    let name = cstr!("fade");
+    let input = cstr!("{\"brightness\":50,\"duration\":1}");
+
+    c.bench_function("webthing_action_new", |b| {
+        b.iter(|| {
+            let action = ffi::webthing_action_new(
+                id.as_ptr() as *mut c_char,
+                name.as_ptr() as *mut c_char,
+                input.as_ptr() as *mut c_char,
+                lock,
+                noop_perform,
+                None,
+            );
+            ffi::webthing_action_free(
+                black_box(action) as *mut Box<dyn Action>
+            );
+        })
+    });
+
+    ffi::webthing_thing_lock_free(lock);
+}
+
+criterion_group!(
+    benches,
+    properties,
+    locks,
+    thing_description,
+    encodings,
+    actions
+);
+criterion_main!(benches);
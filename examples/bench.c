@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "libwebthing.h"
+
+#define ITERATIONS 200000
+#define CLIENTS 8
+#define REQUESTS 500
+
+// Machine readable results, one JSON object per line (-j <file>)
+FILE* json = NULL;
+
+// Allocation counter: the executable's malloc takes precedence over libc's
+// for libwebthing.so as well, so every allocation made through the API is
+// counted here before being handed to glibc.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+unsigned long allocations = 0;
+__thread unsigned long thread_allocations = 0;
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    thread_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    thread_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    thread_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(char* name, double start, double end, int iterations) {
+    double elapsed = end - start;
+    printf("%-40s %10.1f ns/op %12.0f ops/s\n", name, elapsed * 1e9 / iterations, iterations / elapsed);
+    if (json != NULL) {
+        fprintf(json, "{\"time\":%ld,\"name\":\"%s\",\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f}\n", (long) time(NULL), name, elapsed * 1e9 / iterations, iterations / elapsed);
+    }
+}
+
+webthing_thing* make_thing() {
+    webthing_thing* thing = webthing_thing_new("urn:dev:ops:bench-1234", "Bench", NULL, NULL);
+    webthing_property* level = webthing_property_new("level", "0", NULL, "{\"type\":\"number\",\"minimum\":0,\"maximum\":100}");
+    webthing_thing_add_property(thing, level);
+    return thing;
+}
+
+void bench_set_property(webthing_thing* thing) {
+    char buf[32];
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        snprintf(buf, sizeof(buf), "%f", (i % 100) * 0.5);
+        char* err = webthing_thing_set_property(thing, "level", buf);
+        if (err != NULL) {
+            webthing_str_free(err);
+        }
+    }
+    report("webthing_thing_set_property", start, now(), ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        char* err = webthing_thing_set_property_f64(thing, "level", (i % 100) * 0.5);
+        if (err != NULL) {
+            webthing_str_free(err);
+        }
+    }
+    report("webthing_thing_set_property_f64", start, now(), ITERATIONS);
+
+    int index = webthing_thing_property_index(thing, "level");
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        char* err = webthing_thing_set_property_at_f64(thing, index, (i % 100) * 0.5);
+        if (err != NULL) {
+            webthing_str_free(err);
+        }
+    }
+    report("webthing_thing_set_property_at_f64", start, now(), ITERATIONS);
+}
+
+void bench_property_notify(webthing_thing* thing) {
+    char buf[32];
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        snprintf(buf, sizeof(buf), "%f", (i % 100) * 0.5);
+        webthing_thing_property_notify(thing, "level", buf);
+    }
+    report("webthing_thing_property_notify", start, now(), ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_property_notify_f64(thing, "level", (i % 100) * 0.5);
+    }
+    report("webthing_thing_property_notify_f64", start, now(), ITERATIONS);
+
+    int index = webthing_thing_property_index(thing, "level");
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_property_notify_at_f64(thing, index, (i % 100) * 0.5);
+    }
+    report("webthing_thing_property_notify_at_f64", start, now(), ITERATIONS);
+}
+
+void bench_cached_value(webthing_thing* thing) {
+    webthing_property* property = webthing_thing_find_property(thing, "level");
+    char buf[32];
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        snprintf(buf, sizeof(buf), "%f", (i % 100) * 0.5);
+        char* err = webthing_property_set_cached_value(property, buf);
+        if (err != NULL) {
+            webthing_str_free(err);
+        }
+        char* value = webthing_property_get_value(property);
+        double d = atof(value);
+        webthing_str_free(value);
+        (void) d;
+    }
+    report("webthing_property_set_cached_value/get", start, now(), ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        char* err = webthing_property_set_cached_value_f64(property, (i % 100) * 0.5);
+        if (err != NULL) {
+            webthing_str_free(err);
+        }
+        double d;
+        webthing_property_get_value_f64(property, &d);
+    }
+    report("webthing_property_set_cached_value_f64/get", start, now(), ITERATIONS);
+}
+
+void bench_handles(webthing_thing* thing) {
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_has_property(thing, "level");
+    }
+    report("webthing_thing_has_property", start, now(), ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_find_property(thing, "level");
+    }
+    report("webthing_thing_find_property", start, now(), ITERATIONS);
+
+    webthing_property* property = webthing_thing_find_property(thing, "level");
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        double d;
+        webthing_property_get_value_f64(property, &d);
+    }
+    report("webthing_property_get_value_f64", start, now(), ITERATIONS);
+}
+
+void with_read_noop(webthing_thing* thing, void* ctx) {
+}
+
+void bench_locks(webthing_thing_lock* lock) {
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_read_lock* rlock = webthing_thing_lock_read(lock);
+        webthing_thing_unlock_read(rlock);
+    }
+    report("webthing_thing_lock_read/unlock_read", start, now(), ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        webthing_thing_with_read(lock, with_read_noop, NULL);
+    }
+    report("webthing_thing_with_read", start, now(), ITERATIONS);
+}
+
+#define READERS 4
+#define READS 20000
+
+struct contention_args {
+    webthing_thing_lock* lock;
+    webthing_property_snapshot* snapshot;
+    double* latencies;
+};
+
+volatile bool contention_running = false;
+
+void* contention_writer (void* v) {
+    struct contention_args* args = (struct contention_args*) v;
+    int i = 0;
+    while (contention_running) {
+        webthing_thing_write_lock* wlock = webthing_thing_lock_write(args->lock);
+        usleep(200);
+        webthing_thing_set_property_f64(wlock->thing, "level", (i++ % 100) * 0.5);
+        webthing_thing_unlock_write(wlock);
+        usleep(50);
+    }
+    return NULL;
+}
+
+void* contention_reader (void* v) {
+    struct contention_args* args = (struct contention_args*) v;
+    for (int i = 0; i < READS; i++) {
+        double start = now();
+        char* properties;
+        if (args->snapshot != NULL) {
+            properties = webthing_property_snapshot_get_properties(args->snapshot);
+        } else {
+            webthing_thing_read_lock* rlock = webthing_thing_lock_read(args->lock);
+            properties = webthing_thing_get_properties(rlock->thing);
+            webthing_thing_unlock_read(rlock);
+        }
+        args->latencies[i] = now() - start;
+        webthing_str_free(properties);
+    }
+    return NULL;
+}
+
+int compare_double(const void* a, const void* b) {
+    double d = *(const double*) a - *(const double*) b;
+    return (d > 0) - (d < 0);
+}
+
+void run_contention(char* name, webthing_thing_lock* lock, webthing_property_snapshot* snapshot) {
+    double* latencies = malloc(READERS * READS * sizeof(double));
+    struct contention_args args[READERS + 1];
+    pthread_t threads[READERS + 1];
+    contention_running = true;
+    args[READERS] = (struct contention_args) {.lock = lock};
+    pthread_create(&threads[READERS], NULL, contention_writer, &args[READERS]);
+    for (int i = 0; i < READERS; i++) {
+        args[i] = (struct contention_args) {.lock = lock, .snapshot = snapshot, .latencies = latencies + i * READS};
+        pthread_create(&threads[i], NULL, contention_reader, &args[i]);
+    }
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    contention_running = false;
+    pthread_join(threads[READERS], NULL);
+
+    qsort(latencies, READERS * READS, sizeof(double), compare_double);
+    printf("%-40s %10.1f us p50 %10.1f us p99\n", name, latencies[READERS * READS / 2] * 1e6, latencies[READERS * READS * 99 / 100] * 1e6);
+    free(latencies);
+}
+
+void bench_contention(webthing_thing_lock* lock) {
+    webthing_thing_read_lock* rlock = webthing_thing_lock_read(lock);
+    webthing_property_snapshot* snapshot = webthing_thing_get_property_snapshot(rlock->thing);
+    webthing_thing_unlock_read(rlock);
+
+    run_contention("read lock + get_properties", lock, NULL);
+    run_contention("property snapshot", lock, snapshot);
+
+    webthing_property_snapshot_free(snapshot);
+}
+
+long rss_kb() {
+    long pages = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        fscanf(f, "%*ld %ld", &pages);
+        fclose(f);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void noop_perform (webthing_thing_lock* thing, char* action_name, char* action_id) {
+    webthing_thing_lock_free(thing);
+    webthing_str_free(action_name);
+    webthing_str_free(action_id);
+}
+
+void bench_actions() {
+    webthing_thing* thing = make_thing();
+    webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+    webthing_thing_add_available_action(thing, "fade", "{\"title\":\"Fade\"}");
+    webthing_thing_set_action_retention(thing, 100, 0);
+    char id[32];
+    char name[64];
+    for (int batch = 0; batch < 10; batch++) {
+        double start = now();
+        for (int i = 0; i < 100000; i++) {
+            snprintf(id, sizeof(id), "action-%d-%d", batch, i);
+            webthing_action* action = webthing_action_new(id, "fade", NULL, lock, noop_perform, NULL);
+            webthing_thing_add_action(thing, action, NULL);
+            webthing_thing_finish_action(thing, "fade", id);
+        }
+        double end = now();
+        snprintf(name, sizeof(name), "add+finish action (%dk, %ld kB RSS)", (batch + 1) * 100, rss_kb());
+        report(name, start, end, 100000);
+    }
+    webthing_thing_lock_free(lock);
+}
+
+void bench_thing_description() {
+    webthing_thing* thing = webthing_thing_new("urn:dev:ops:bench-td", "Bench TD", NULL, NULL);
+    char name[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "level-%d", i);
+        webthing_thing_add_property(thing, webthing_property_new(name, "0", NULL, "{\"type\":\"number\",\"title\":\"Level\",\"minimum\":0,\"maximum\":100,\"unit\":\"percent\"}"));
+    }
+    int iterations = ITERATIONS / 100;
+    double start = now();
+    for (int i = 0; i < iterations; i++) {
+        webthing_thing_set_href_prefix(thing, i % 2 ? "/a" : "/b");
+        webthing_str_free(webthing_thing_as_thing_description(thing));
+    }
+    report("as_thing_description (200 props, render)", start, now(), iterations);
+
+    start = now();
+    for (int i = 0; i < iterations; i++) {
+        webthing_str_free(webthing_thing_as_thing_description(thing));
+    }
+    report("as_thing_description (200 props, cached)", start, now(), iterations);
+    webthing_thing_free(thing);
+}
+
+webthing_action* no_action_generate (webthing_thing_lock* thing, char* name, char* input) {
+    return NULL;
+}
+
+int http_get(unsigned short port, char* path) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    char request[256];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost:%d\r\nConnection: close\r\n\r\n", path, port);
+    write(fd, request, len);
+    char response[64] = {0};
+    int status = -1;
+    if (read(fd, response, sizeof(response) - 1) > 0) {
+        sscanf(response, "HTTP/1.1 %d", &status);
+    }
+    close(fd);
+    return status;
+}
+
+void* http_load (void* v) {
+    unsigned short port = *(unsigned short*) v;
+    for (int i = 0; i < REQUESTS; i++) {
+        http_get(port, "/properties");
+    }
+    return NULL;
+}
+
+void bench_server(webthing_thing_lock* lock) {
+    webthing_action_generator gen = {.generate = no_action_generate};
+    int cpus[] = {1, 2, 4};
+    for (int c = 0; c < 3; c++) {
+        unsigned short port = 8900 + c;
+        webthing_server_options options = {.cpu_affinity = (1ULL << cpus[c]) - 1};
+        webthing_server* server = webthing_server_spawn_single(lock, port, NULL, NULL, &gen, NULL, true, &options);
+        if (server == NULL) {
+            continue;
+        }
+        while (http_get(port, "/properties") != 200) {
+            usleep(10000);
+        }
+
+        pthread_t threads[CLIENTS];
+        double start = now();
+        for (int i = 0; i < CLIENTS; i++) {
+            pthread_create(&threads[i], NULL, http_load, &port);
+        }
+        for (int i = 0; i < CLIENTS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "GET /properties (%d cpu)", cpus[c]);
+        report(name, start, now(), CLIENTS * REQUESTS);
+
+        webthing_server_stop(server, 5000);
+    }
+}
+
+enum mix_op {MIX_READ, MIX_WRITE, MIX_SET, MIX_NOTIFY, MIX_OPS};
+char* mix_names[] = {"read", "write", "set", "notify"};
+
+struct mix_args {
+    webthing_thing_lock* lock;
+    int* ratios;
+    int ops;
+    unsigned int seed;
+    double* latencies[MIX_OPS];
+    int counts[MIX_OPS];
+    unsigned long allocations[MIX_OPS];
+};
+
+void* mix_worker (void* v) {
+    struct mix_args* args = (struct mix_args*) v;
+    int total = 0;
+    for (int k = 0; k < MIX_OPS; k++) {
+        total += args->ratios[k];
+    }
+    for (int i = 0; i < args->ops; i++) {
+        int pick = rand_r(&args->seed) % total;
+        int op = 0;
+        while (pick >= args->ratios[op]) {
+            pick -= args->ratios[op++];
+        }
+        unsigned long before = thread_allocations;
+        double start = now();
+        if (op == MIX_READ) {
+            webthing_thing_read_lock* rlock = webthing_thing_lock_read(args->lock);
+            webthing_str_free(webthing_thing_get_property(rlock->thing, "level"));
+            webthing_thing_unlock_read(rlock);
+        } else {
+            webthing_thing_write_lock* wlock = webthing_thing_lock_write(args->lock);
+            if (op == MIX_SET) {
+                char* err = webthing_thing_set_property_f64(wlock->thing, "level", (i % 100) * 0.5);
+                if (err != NULL) {
+                    webthing_str_free(err);
+                }
+            } else if (op == MIX_NOTIFY) {
+                webthing_thing_property_notify_f64(wlock->thing, "level", (i % 100) * 0.5);
+            }
+            webthing_thing_unlock_write(wlock);
+        }
+        args->latencies[op][args->counts[op]++] = now() - start;
+        args->allocations[op] += thread_allocations - before;
+    }
+    return NULL;
+}
+
+void report_latencies(char* name, double* latencies, int count, double elapsed, double allocs, int threads, char* mix) {
+    if (count == 0) {
+        return;
+    }
+    qsort(latencies, count, sizeof(double), compare_double);
+    double p50 = latencies[count / 2] * 1e9;
+    double p99 = latencies[(long) count * 99 / 100] * 1e9;
+    double p999 = latencies[(long) count * 999 / 1000] * 1e9;
+    printf("%-40s %12.0f ops/s %9.0f ns p50 %9.0f ns p99 %9.0f ns p999 %6.1f allocs/op\n", name, count / elapsed, p50, p99, p999, allocs / count);
+    if (json != NULL) {
+        fprintf(json, "{\"time\":%ld,\"name\":\"%s\",\"threads\":%d,\"mix\":\"%s\",\"ops\":%d,\"ops_per_sec\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"allocs_per_op\":%.2f}\n", (long) time(NULL), name, threads, mix, count, count / elapsed, p50, p99, p999, allocs / count);
+    }
+}
+
+void bench_mix(webthing_thing_lock* lock, int threads, char* mix, int ops) {
+    int ratios[MIX_OPS] = {0};
+    if (sscanf(mix, "%d:%d:%d:%d", &ratios[MIX_READ], &ratios[MIX_WRITE], &ratios[MIX_SET], &ratios[MIX_NOTIFY]) != MIX_OPS
+            || ratios[MIX_READ] + ratios[MIX_WRITE] + ratios[MIX_SET] + ratios[MIX_NOTIFY] <= 0) {
+        fprintf(stderr, "Invalid mix '%s', expected read:write:set:notify ratios like 70:10:10:10\n", mix);
+        return;
+    }
+
+    struct mix_args* args = calloc(threads, sizeof(struct mix_args));
+    pthread_t* handles = malloc(threads * sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        args[t] = (struct mix_args) {.lock = lock, .ratios = ratios, .ops = ops, .seed = t + 1};
+        for (int k = 0; k < MIX_OPS; k++) {
+            args[t].latencies[k] = malloc(ops * sizeof(double));
+        }
+    }
+
+    double start = now();
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&handles[t], NULL, mix_worker, &args[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+    }
+    double elapsed = now() - start;
+
+    double* latencies = malloc((long) threads * ops * sizeof(double));
+    int all = 0;
+    double all_allocs = 0;
+    char name[64];
+    for (int k = 0; k < MIX_OPS; k++) {
+        int count = 0;
+        double allocs = 0;
+        for (int t = 0; t < threads; t++) {
+            memcpy(latencies + count, args[t].latencies[k], args[t].counts[k] * sizeof(double));
+            count += args[t].counts[k];
+            allocs += args[t].allocations[k];
+        }
+        snprintf(name, sizeof(name), "mix %s (%d threads)", mix_names[k], threads);
+        report_latencies(name, latencies, count, elapsed, allocs, threads, mix);
+        all += count;
+        all_allocs += allocs;
+    }
+    for (int t = 0, count = 0; t < threads; t++) {
+        for (int k = 0; k < MIX_OPS; k++) {
+            memcpy(latencies + count, args[t].latencies[k], args[t].counts[k] * sizeof(double));
+            count += args[t].counts[k];
+            free(args[t].latencies[k]);
+        }
+    }
+    snprintf(name, sizeof(name), "mix %s (%d threads)", mix, threads);
+    report_latencies(name, latencies, all, elapsed, all_allocs, threads, mix);
+
+    free(latencies);
+    free(handles);
+    free(args);
+}
+
+int main (int argc, char** argv) {
+    int threads = 4;
+    char* mix = "70:10:10:10";
+    int ops = 100000;
+    bool mix_only = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:n:j:x")) != -1) {
+        switch (opt) {
+            case 't': threads = atoi(optarg); break;
+            case 'm': mix = optarg; break;
+            case 'n': ops = atoi(optarg); break;
+            case 'j': json = fopen(optarg, "a"); break;
+            case 'x': mix_only = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads] [-m read:write:set:notify] [-n ops per thread] [-j results.jsonl] [-x]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (threads < 1 || ops < 1) {
+        fprintf(stderr, "Thread and operation counts must be positive\n");
+        return 1;
+    }
+
+    webthing_thing* thing = make_thing();
+
+    if (!mix_only) {
+        bench_set_property(thing);
+        bench_property_notify(thing);
+        bench_cached_value(thing);
+        bench_handles(thing);
+        bench_actions();
+        bench_thing_description();
+    }
+
+    webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+    if (!mix_only) {
+        bench_locks(lock);
+        bench_contention(lock);
+        bench_server(lock);
+    }
+    bench_mix(lock, threads, mix, ops);
+    webthing_thing_lock_free(lock);
+
+    if (json != NULL) {
+        fclose(json);
+    }
+    return 0;
+}
@@ -29,18 +29,15 @@ void sensor_t (void* arg) {
 
         printf("setting new humidity level: %s\n", new_value);
 
-        webthing_thing_write_lock* wlock = webthing_thing_lock_write(thing);
-        webthing_property* prop = webthing_thing_find_property(wlock->thing, "level");
-        char* stat = webthing_property_set_cached_value(prop, new_value);
+        webthing_property_value values[] = {{.name = "level", .value = new_value}};
+        char* stat = webthing_thing_update_properties(thing, values, 1);
         if (stat != 0) {
             printf("Failed to update property: %s\n", stat);
             webthing_str_free(stat);
             return 1;
         }
-        webthing_thing_property_notify(wlock->thing, "level", new_value);
         
         free(new_value);
-        webthing_thing_unlock_write(wlock);
     }
 
     webthing_thing_lock_free(thing);
@@ -121,6 +118,9 @@ webthing_thing* make_sensor() {
     webthing_property* level_property = webthing_property_new("level", "0", NULL, level_description);
     webthing_thing_add_property(thing, level_property);
 
+    webthing_notify_policy level_policy = {.deadband = 0.5};
+    webthing_thing_set_notify_policy(thing, "level", &level_policy);
+
     webthing_thing_lock* lock = webthing_thing_lock_new(thing);
 
     pthread_t thread;
@@ -129,21 +129,13 @@ webthing_thing* make_sensor() {
     return lock;
 }
 
-struct perform_t_args {
-    webthing_thing_lock* thing;
-    char* action_name;
-    char* action_id;
-};
-
-void perform_t(void* v) {
-    struct perform_t_args* args = (struct perform_t_args*) v;
-    webthing_thing_lock* thinglock = args->thing;
+void perform(webthing_thing_lock* thinglock, char* action_name, char* action_id) {
+    printf("Performing action %s(%s)\n", action_name, action_id);
     webthing_thing_read_lock* thingrlock = webthing_thing_lock_read(thinglock);
 
-    webthing_action_lock* actionlock = webthing_thing_get_action(thingrlock->thing, args->action_name, args->action_id);
-    free(args->action_name);
-    free(args->action_id);
-    free(args);
+    webthing_action_lock* actionlock = webthing_thing_get_action(thingrlock->thing, action_name, action_id);
+    webthing_str_free(action_name);
+    webthing_str_free(action_id);
     
     webthing_action_read_lock* actionrlock = webthing_action_lock_read(actionlock);
     
@@ -195,20 +187,6 @@ void perform_t(void* v) {
     webthing_thing_lock_free(thinglock);
 }
 
-void perform(webthing_thing_lock* thing, char* action_name, char* action_id) {
-    printf("Performing action %s(%s)\n", action_name, action_id);
-    pthread_t thread;
-    struct perform_t_args* args = (struct perform_t_args*) malloc(sizeof(struct perform_t_args));
-    args->thing = thing;
-    args->action_name = malloc((strlen(action_name)+1)*sizeof(char));
-    strcpy(args->action_name, action_name);
-    args->action_id = malloc((strlen(action_id)+1)*sizeof(char));
-    strcpy(args->action_id, action_id);
-    pthread_create(&thread, NULL, &perform_t, (void*) args);
-    webthing_str_free(action_name);
-    webthing_str_free(action_id);
-}
-
 webthing_action* generate (webthing_thing_lock* thing, char* name, char* input) {
     webthing_action* action;
     if (input == NULL) { 
@@ -3,7 +3,6 @@
 #include <stdbool.h>
 #include <string.h>
 #include <regex.h>
-#include <pthread.h>
 #include "libwebthing.h"
 
 char* on_set_value (char* value) {
@@ -72,21 +71,13 @@ webthing_thing_lock* make_thing() {
     return webthing_thing_lock_new(thing);
 }
 
-struct perform_t_args {
-    webthing_thing_lock* thing;
-    char* action_name;
-    char* action_id;
-};
-
-void perform_t(void* v) {
-    struct perform_t_args* args = (struct perform_t_args*) v;
-    webthing_thing_lock* thinglock = args->thing;
+void perform(webthing_thing_lock* thinglock, char* action_name, char* action_id) {
+    printf("Performing action %s(%s)\n", action_name, action_id);
     webthing_thing_read_lock* thingrlock = webthing_thing_lock_read(thinglock);
 
-    webthing_action_lock* actionlock = webthing_thing_get_action(thingrlock->thing, args->action_name, args->action_id);
-    free(args->action_name);
-    free(args->action_id);
-    free(args);
+    webthing_action_lock* actionlock = webthing_thing_get_action(thingrlock->thing, action_name, action_id);
+    webthing_str_free(action_name);
+    webthing_str_free(action_id);
 
     webthing_action_read_lock* actionrlock = webthing_action_lock_read(actionlock);
     
@@ -138,20 +129,6 @@ void perform_t(void* v) {
     webthing_thing_lock_free(thinglock);
 }
 
-void perform(webthing_thing_lock* thing, char* action_name, char* action_id) {
-    printf("Performing action %s(%s)\n", action_name, action_id);
-    pthread_t thread;
-    struct perform_t_args* args = (struct perform_t_args*) malloc(sizeof(struct perform_t_args));
-    args->thing = thing;
-    args->action_name = malloc((strlen(action_name)+1)*sizeof(char));
-    strcpy(args->action_name, action_name);
-    args->action_id = malloc((strlen(action_id)+1)*sizeof(char));
-    strcpy(args->action_id, action_id);
-    pthread_create(&thread, NULL, &perform_t, (void*) args);
-    webthing_str_free(action_name);
-    webthing_str_free(action_id);
-}
-
 webthing_action* generate (webthing_thing_lock* thing, char* name, char* input) {
     webthing_action* action;
     if (input == NULL) { 
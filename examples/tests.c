@@ -2,6 +2,13 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include "libwebthing.h"
 
 webthing_thing* make_thing() {
@@ -34,6 +41,13 @@ void action_perform (webthing_thing_lock* thing, char* action_name, char* action
     webthing_str_free(action_id);
 }
 
+void action_perform_slow (webthing_thing_lock* thing, char* action_name, char* action_id) {
+    usleep(2000);
+    webthing_thing_lock_free(thing);
+    webthing_str_free(action_name);
+    webthing_str_free(action_id);
+}
+
 bool action_cancel_feedback = false;
 
 void action_cancel (webthing_thing_lock* thing, char* action_name, char* action_id) {
@@ -43,6 +57,48 @@ void action_cancel (webthing_thing_lock* thing, char* action_name, char* action_
     webthing_str_free(action_id);
 }
 
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+int pool_active = 0;
+int pool_max_active = 0;
+int pool_done = 0;
+bool pool_release = false;
+
+void action_perform_blocking (webthing_thing_lock* thing, char* action_name, char* action_id) {
+    pthread_mutex_lock(&pool_mutex);
+    pool_active++;
+    if (pool_active > pool_max_active) {
+        pool_max_active = pool_active;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    while (!__atomic_load_n(&pool_release, __ATOMIC_SEQ_CST)) {
+        usleep(1000);
+    }
+    pthread_mutex_lock(&pool_mutex);
+    pool_active--;
+    pool_done++;
+    pthread_mutex_unlock(&pool_mutex);
+    webthing_thing_lock_free(thing);
+    webthing_str_free(action_name);
+    webthing_str_free(action_id);
+}
+
+int pool_get(int* v) {
+    pthread_mutex_lock(&pool_mutex);
+    int res = *v;
+    pthread_mutex_unlock(&pool_mutex);
+    return res;
+}
+
+long rss_kb() {
+    long pages = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        fscanf(f, "%*ld %ld", &pages);
+        fclose(f);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
 webthing_property* make_number_property() {
     webthing_value_forwarder gen = {.set_value = number_set_value};
     webthing_property* prop = webthing_property_new("brightness", "50", &gen, "{\"@type\":\"BrightnessProperty\",\"title\":\"Brightness\",\"type\":\"integer\",\"description\":\"The level of light from 0-100\",\"minimum\":0,\"maximum\":100,\"unit\":\"percent\"}");
@@ -54,6 +110,227 @@ webthing_property* make_readonly_property() {
     return prop;
 }
 
+void with_read_get_id (webthing_thing* thing, void* ctx) {
+    *(char**) ctx = webthing_thing_get_id(thing);
+}
+
+void with_write_set_href_prefix (webthing_thing* thing, void* ctx) {
+    webthing_thing_set_href_prefix(thing, (char*) ctx);
+}
+
+webthing_action* make_action (webthing_thing_lock* thing, char* name, char* input, void (*perform) (webthing_thing_lock* thing, char* action_name, char* action_id)) {
+    webthing_action* action = webthing_action_new(NULL, name, input, thing, perform, NULL);
+    webthing_thing_lock_free(thing);
+    webthing_str_free(name);
+    if (input != NULL) {
+        webthing_str_free(input);
+    }
+    return action;
+}
+
+webthing_action* action_generate (webthing_thing_lock* thing, char* name, char* input) {
+    return make_action(thing, name, input, action_perform);
+}
+
+webthing_action* blocking_action_generate (webthing_thing_lock* thing, char* name, char* input) {
+    return make_action(thing, name, input, action_perform_blocking);
+}
+
+webthing_action* no_action_generate (webthing_thing_lock* thing, char* name, char* input) {
+    webthing_thing_lock_free(thing);
+    webthing_str_free(name);
+    if (input != NULL) {
+        webthing_str_free(input);
+    }
+    return NULL;
+}
+
+int http_exchange(unsigned short port, char* method, char* path, char* headers, char* body, char* response, size_t size) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    char request[512];
+    char* content_type = strstr(headers, "Content-Type:") == NULL ? "Content-Type: application/json\r\n" : "";
+    int len = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: localhost:%d\r\nConnection: close\r\n%s%sContent-Length: %zu\r\n\r\n%s", method, path, port, content_type, headers, strlen(body), body);
+    write(fd, request, len);
+    size_t total = 0;
+    ssize_t n;
+    while (total < size - 1 && (n = read(fd, response + total, size - 1 - total)) > 0) {
+        total += n;
+    }
+    response[total] = 0;
+    int status = -1;
+    sscanf(response, "HTTP/1.1 %d", &status);
+    close(fd);
+    return status;
+}
+
+char* http_header(char* response, char* name) {
+    size_t len = strlen(name);
+    for (char* line = strstr(response, "\r\n"); line != NULL && strncmp(line, "\r\n\r\n", 4) != 0; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, len) == 0 && line[len + 2] == ':') {
+            return line + len + 4;
+        }
+    }
+    return "";
+}
+
+int http_request(unsigned short port, char* method, char* path, char* body) {
+    char response[64];
+    return http_exchange(port, method, path, "", body, response, sizeof(response));
+}
+
+int http_get(unsigned short port, char* path) {
+    return http_request(port, "GET", path, "");
+}
+
+char* http_body(char* response) {
+    char* body = strstr(response, "\r\n\r\n");
+    return body == NULL ? "" : body + 4;
+}
+
+int ws_connect(unsigned short port, char* path, char* headers) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    struct timeval timeout = {.tv_sec = 2};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    char request[512];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n%s\r\n", path, port, headers);
+    write(fd, request, len);
+    char response[512];
+    size_t total = 0;
+    while (total < sizeof(response) - 1 && read(fd, response + total, 1) == 1) {
+        response[++total] = 0;
+        if (total >= 4 && strcmp(response + total - 4, "\r\n\r\n") == 0) {
+            break;
+        }
+    }
+    int status = -1;
+    if (total == 0 || sscanf(response, "HTTP/1.1 %d", &status) != 1 || status != 101) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends a single masked frame with a zero masking key.
+void ws_send(int fd, int opcode, unsigned char* payload, size_t len) {
+    unsigned char frame[256] = {0x80 | opcode, 0x80 | len};
+    memcpy(frame + 6, payload, len);
+    write(fd, frame, len + 6);
+}
+
+// Reads a single unmasked frame of up to 125 bytes, returning its opcode.
+int ws_read(int fd, unsigned char* payload, size_t* len) {
+    unsigned char head[2];
+    if (read(fd, head, 2) != 2 || (head[1] & 0x7f) > 125) {
+        return -1;
+    }
+    *len = head[1] & 0x7f;
+    for (size_t total = 0; total < *len;) {
+        ssize_t n = read(fd, payload + total, *len - total);
+        if (n <= 0) {
+            return -1;
+        }
+        total += n;
+    }
+    return head[0] & 0x0f;
+}
+
+bool contains_bytes(unsigned char* haystack, size_t len, char* needle, size_t needle_len) {
+    for (size_t i = 0; i + needle_len <= len; i++) {
+        if (memcmp(haystack + i, needle, needle_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct async_value {
+    webthing_value_token* token;
+    char* value;
+};
+
+void* complete_value_later (void* v) {
+    struct async_value* args = (struct async_value*) v;
+    usleep(20000);
+    webthing_value_forwarder_complete(args->token, args->value);
+    webthing_str_free(args->value);
+    free(args);
+    return NULL;
+}
+
+void number_set_value_async (webthing_value_token* token, char* value) {
+    struct async_value* args = malloc(sizeof(struct async_value));
+    args->token = token;
+    args->value = value;
+    pthread_t thread;
+    pthread_create(&thread, NULL, complete_value_later, args);
+    pthread_detach(thread);
+}
+
+pthread_mutex_t held_mutex = PTHREAD_MUTEX_INITIALIZER;
+webthing_value_token* held_token = NULL;
+char* held_value = NULL;
+bool held_completed = false;
+
+void number_set_value_held (webthing_value_token* token, char* value) {
+    pthread_mutex_lock(&held_mutex);
+    held_token = token;
+    held_value = value;
+    pthread_mutex_unlock(&held_mutex);
+}
+
+bool number_value_held() {
+    pthread_mutex_lock(&held_mutex);
+    bool held = held_token != NULL;
+    pthread_mutex_unlock(&held_mutex);
+    return held;
+}
+
+void* complete_held_value (void* delay) {
+    usleep((size_t) delay);
+    pthread_mutex_lock(&held_mutex);
+    if (held_token != NULL) {
+        webthing_value_forwarder_complete(held_token, held_value);
+        webthing_str_free(held_value);
+        held_token = NULL;
+        held_completed = true;
+    }
+    pthread_mutex_unlock(&held_mutex);
+    return NULL;
+}
+
+void* http_put_brightness (void* status) {
+    *(int*) status = http_request(8890, "PUT", "/properties/brightness", "{\"brightness\":40}");
+    return NULL;
+}
+
+struct http_load_args {
+    unsigned short port;
+    char* path;
+    int ok;
+};
+
+void* http_load (void* v) {
+    struct http_load_args* args = (struct http_load_args*) v;
+    for (int i = 0; i < 50; i++) {
+        if (http_get(args->port, args->path != NULL ? args->path : "/properties") == 200) {
+            args->ok++;
+        }
+    }
+    return NULL;
+}
+
 int main (void) {
     int counter = 0;
     {
@@ -106,6 +383,23 @@ int main (void) {
         counter++;
     }
     printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        char buf[16];
+        int len = webthing_thing_get_id_buf(thing, buf, sizeof(buf));
+        assert(len == 24);
+        assert(strcmp(buf, "urn:dev:ops:my-") == 0);
+        len = webthing_thing_get_title_buf(thing, buf, sizeof(buf));
+        assert(len == 7);
+        assert(strcmp(buf, "My Lamp") == 0);
+        len = webthing_thing_get_title_buf(thing, NULL, 0);
+        assert(len == 7);
+        len = webthing_thing_get_ui_href_buf(thing, buf, sizeof(buf));
+        assert(len == -1);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
     {
         webthing_thing* thing = make_thing_without();
         char* _ = webthing_thing_get_id(thing);
@@ -186,6 +480,9 @@ int main (void) {
         _ = webthing_property_get_name(property);
         assert(strcmp(_, "\"brightness\"") == 0); // Why though?
         webthing_str_free(_);
+        char name[16];
+        assert(webthing_property_get_name_buf(property, name, sizeof(name)) == 10);
+        assert(strcmp(name, "brightness") == 0);
         _ = webthing_property_get_metadata(property);
         assert(strcmp(_, "{\"@type\":\"BrightnessProperty\",\"description\":\"The level of light from 0-100\",\"maximum\":100,\"minimum\":0,\"title\":\"Brightness\",\"type\":\"integer\",\"unit\":\"percent\"}") == 0);
         webthing_str_free(_);
@@ -337,6 +634,90 @@ int main (void) {
         counter++;
     }
     printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        webthing_property* property = make_number_property();
+        char* _ = webthing_thing_set_property_i64(thing, "brightness", 75);
+        assert(strcmp(_, "Property not found") == 0);
+        webthing_str_free(_);
+        webthing_thing_add_property(thing, property);
+        _ = webthing_thing_set_property_i64(thing, "brightness", 75);
+        assert(_ == 0);
+        webthing_thing_property_notify_i64(thing, "brightness", 75);
+        _ = webthing_thing_get_properties(thing);
+        assert(strcmp(_, "{\"brightness\":75}") == 0);
+        webthing_str_free(_);
+        _ = webthing_thing_set_property_str(thing, "brightness", "75");
+        assert(strcmp(_, "Invalid property value") == 0);
+        webthing_str_free(_);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        assert(webthing_thing_property_index(thing, "brightness") == -1);
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_thing_add_property(thing, webthing_property_new("on", "false", NULL, "{\"type\":\"boolean\"}"));
+        int index = webthing_thing_property_index(thing, "brightness");
+        assert(index == 0);
+        assert(webthing_thing_property_index(thing, "on") == 1);
+        char* _ = webthing_thing_set_property_at_i64(thing, index, 75);
+        assert(_ == 0);
+        _ = webthing_thing_get_property_at(thing, index);
+        assert(strcmp(_, "75") == 0);
+        webthing_str_free(_);
+        _ = webthing_thing_set_cached_value_at(thing, index, "20");
+        assert(_ == 0);
+        webthing_thing_property_notify_at_i64(thing, index, 20);
+        _ = webthing_thing_get_property(thing, "brightness");
+        assert(strcmp(_, "20") == 0);
+        webthing_str_free(_);
+        _ = webthing_thing_set_property_at(thing, 1, "75");
+        assert(strcmp(_, "Invalid property value") == 0);
+        webthing_str_free(_);
+        _ = webthing_thing_set_property_at(thing, 7, "75");
+        assert(strcmp(_, "Property not found") == 0);
+        webthing_str_free(_);
+        webthing_thing_remove_property(thing, "brightness");
+        assert(webthing_thing_property_index(thing, "brightness") == -1);
+        _ = webthing_thing_set_property_at_f64(thing, index, 75);
+        assert(strcmp(_, "Property not found") == 0);
+        webthing_str_free(_);
+        _ = webthing_thing_get_property_at(thing, index);
+        assert(strcmp(_, "null") == 0);
+        webthing_str_free(_);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+    {
+        webthing_property* property = make_readonly_property();
+        int64_t i = 0;
+        bool b = false;
+        char* _ = webthing_property_set_cached_value_i64(property, 100);
+        assert(_ == 0);
+        assert(webthing_property_get_value_i64(property, &i));
+        assert(i == 100);
+        assert(!webthing_property_get_value_bool(property, &b));
+        assert(webthing_property_get_value_str(property) == NULL);
+        double d = 0;
+        _ = webthing_property_set_cached_value_f64(property, 12.5);
+        assert(_ == 0);
+        assert(webthing_property_get_value_f64(property, &d));
+        assert(d == 12.5);
+        _ = webthing_property_set_cached_value_str(property, "on");
+        assert(_ == 0);
+        _ = webthing_property_get_value_str(property);
+        assert(strcmp(_, "on") == 0);
+        webthing_str_free(_);
+        _ = webthing_property_get_value(property);
+        assert(strcmp(_, "\"on\"") == 0);
+        webthing_str_free(_);
+        webthing_property_free(property);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
     {
         webthing_thing* thing = make_thing();
         webthing_property* property = make_number_property();
@@ -383,6 +764,58 @@ int main (void) {
         counter++;
     }
     printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_thing_with_write(lock, with_write_set_href_prefix, "/0");
+        char* _ = NULL;
+        webthing_thing_with_read(lock, with_read_get_id, &_);
+        assert(strcmp(_, "urn:dev:ops:my-lamp-1234") == 0);
+        webthing_str_free(_);
+        webthing_thing_read_lock* rlock = webthing_thing_lock_read(lock);
+        _ = webthing_thing_get_href_prefix(rlock->thing);
+        assert(strcmp(_, "/0") == 0);
+        webthing_str_free(_);
+        webthing_thing_unlock_read(rlock);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_thing_add_property(thing, webthing_property_new("on", "false", NULL, "{\"type\":\"boolean\"}"));
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_property_value values[] = {
+            {.name = "brightness", .value = "20"},
+            {.name = "on", .value = "true"},
+            {.name = "darkness", .value = "1"}
+        };
+        char* _ = webthing_thing_update_properties(lock, values, 3);
+        assert(strcmp(_, "Property not found") == 0);
+        webthing_str_free(_);
+        webthing_thing_read_lock* rlock = webthing_thing_lock_read(lock);
+        _ = webthing_thing_get_properties(rlock->thing);
+        assert(strcmp(_, "{\"brightness\":20,\"on\":true}") == 0);
+        webthing_str_free(_);
+        webthing_thing_unlock_read(rlock);
+        webthing_thing_write_lock* wlock = webthing_thing_lock_write(lock);
+        webthing_thing_add_subscriber(wlock->thing, "ws-1");
+        webthing_thing_unlock_write(wlock);
+        _ = webthing_thing_update_properties(lock, values, 2);
+        assert(_ == 0);
+        wlock = webthing_thing_lock_write(lock);
+        webthing_thing_property_notify_i64(wlock->thing, "brightness", 30);
+        webthing_str_arr* arr = webthing_thing_drain_queue(wlock->thing, "ws-1");
+        assert(arr->len == 2);
+        assert(strcmp(arr->ptr[0], "{\"data\":{\"brightness\":20,\"on\":true},\"messageType\":\"propertyStatus\"}") == 0);
+        assert(strcmp(arr->ptr[1], "{\"data\":{\"brightness\":30},\"messageType\":\"propertyStatus\"}") == 0);
+        webthing_str_arr_free(arr);
+        webthing_thing_unlock_write(wlock);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
     {
         webthing_thing* thing = make_thing();
         webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
@@ -648,6 +1081,782 @@ int main (void) {
         counter++;
     }
     printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8891, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        pthread_t threads[4];
+        struct http_load_args args[4];
+        for (int i = 0; i < 4; i++) {
+            args[i] = (struct http_load_args) {.port = 8891, .ok = 0};
+            pthread_create(&threads[i], NULL, http_load, &args[i]);
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            assert(args[i].ok == 50);
+        }
+        assert(webthing_server_stop(server, 5000));
+        assert(http_get(8891, "/properties") == -1);
+        webthing_server_options options = {.cpu_affinity = 1};
+        server = webthing_server_spawn_single(lock, 8892, NULL, NULL, &gen, NULL, true, &options);
+        assert(server != NULL);
+        assert(http_get(8892, "/properties") == 200);
+        assert(webthing_server_stop(server, 5000));
+        options = (webthing_server_options) {.cpu_affinity = 1ULL << 63};
+        if (sysconf(_SC_NPROCESSORS_CONF) < 64) {
+            assert(webthing_server_spawn_single(lock, 8892, NULL, NULL, &gen, NULL, true, &options) == NULL);
+        }
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
+        webthing_action_pool_configure(4, 2);
+        webthing_action_pool_set_limit("fadeoff", 1);
+        char* ids[4] = {"pool-1", "pool-2", "pool-3", "pool-4"};
+        webthing_action* actions[4];
+        for (int i = 0; i < 4; i++) {
+            actions[i] = webthing_action_new(ids[i], "fadeoff", NULL, lock, action_perform_blocking, NULL);
+            webthing_thing_add_action(thing, actions[i], NULL);
+        }
+        webthing_thing_start_action(thing, "fadeoff", "pool-1");
+        while (pool_get(&pool_active) != 1) {
+            usleep(1000);
+        }
+        webthing_thing_start_action(thing, "fadeoff", "pool-2");
+        webthing_thing_start_action(thing, "fadeoff", "pool-3");
+        webthing_thing_start_action(thing, "fadeoff", "pool-4");
+        char* _ = webthing_action_get_status(actions[3]);
+        assert(strcmp(_, "rejected") == 0);
+        webthing_str_free(_);
+        __atomic_store_n(&pool_release, true, __ATOMIC_SEQ_CST);
+        while (pool_get(&pool_done) != 3) {
+            usleep(1000);
+        }
+        assert(pool_max_active == 1);
+        webthing_action_pool_set_limit("fadeoff", 0);
+        webthing_action_pool_configure(4, 64);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_property* property = make_number_property();
+        webthing_thing_add_property(thing, property);
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_property_snapshot* snapshot = webthing_thing_get_property_snapshot(thing);
+        char* _ = webthing_property_snapshot_get_properties(snapshot);
+        assert(strcmp(_, "{\"brightness\":50}") == 0);
+        webthing_str_free(_);
+        webthing_thing_write_lock* wlock = webthing_thing_lock_write(lock);
+        webthing_thing_set_property_i64(wlock->thing, "brightness", 42);
+        _ = webthing_property_snapshot_get_property(snapshot, "brightness");
+        assert(strcmp(_, "42") == 0);
+        webthing_str_free(_);
+        webthing_thing_property_notify_i64(wlock->thing, "brightness", 43);
+        webthing_thing_unlock_write(wlock);
+        _ = webthing_property_snapshot_get_property(snapshot, "brightness");
+        assert(strcmp(_, "43") == 0);
+        webthing_str_free(_);
+        assert(webthing_property_set_cached_value_i64(property, 44) == NULL);
+        _ = webthing_property_snapshot_get_property(snapshot, "brightness");
+        assert(strcmp(_, "44") == 0);
+        webthing_str_free(_);
+        assert(webthing_property_set_value(property, "45") == NULL);
+        _ = webthing_property_snapshot_get_property(snapshot, "brightness");
+        assert(strcmp(_, "45") == 0);
+        webthing_str_free(_);
+        assert(webthing_property_snapshot_get_property(snapshot, "unknown") == NULL);
+        webthing_thing_remove_property(thing, "brightness");
+        _ = webthing_property_snapshot_get_properties(snapshot);
+        assert(strcmp(_, "{}") == 0);
+        webthing_str_free(_);
+        webthing_property_snapshot_free(snapshot);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_available_event(thing, "overheated", "{\"description\":\"too hot\"}");
+        webthing_thing_add_available_event(thing, "cooled", "{\"description\":\"cool again\"}");
+        webthing_thing_set_event_capacity(thing, NULL, 3);
+        webthing_thing_set_event_capacity(thing, "cooled", 1);
+        char data[16];
+        for (int i = 0; i < 5; i++) {
+            snprintf(data, sizeof(data), "%d", i);
+            webthing_thing_add_event(thing, webthing_event_new("overheated", data));
+            webthing_thing_add_event(thing, webthing_event_new("cooled", data));
+        }
+        uint64_t last = 0;
+        char* _ = webthing_thing_get_event_descriptions_since(thing, "overheated", 0, 0, &last);
+        assert(strstr(_, "\"data\":1,") == NULL);
+        assert(strstr(_, "\"data\":2,") != NULL);
+        assert(strstr(_, "\"data\":4,") != NULL);
+        webthing_str_free(_);
+        assert(last == 9);
+        _ = webthing_thing_get_event_descriptions_since(thing, NULL, 0, 2, &last);
+        assert(memcmp("[{\"overheated\":{\"data\":2,", _, 25) == 0);
+        assert(strstr(_, "{\"overheated\":{\"data\":3,") != NULL);
+        webthing_str_free(_);
+        assert(last == 7);
+        _ = webthing_thing_get_event_descriptions_since(thing, NULL, last, 0, &last);
+        assert(memcmp("[{\"overheated\":{\"data\":4,", _, 25) == 0);
+        assert(strstr(_, "{\"cooled\":{\"data\":4,") != NULL);
+        webthing_str_free(_);
+        assert(last == 10);
+        _ = webthing_thing_get_event_descriptions_since(thing, NULL, last, 0, &last);
+        assert(strcmp(_, "[]") == 0);
+        webthing_str_free(_);
+        assert(last == 10);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_available_event(thing, "overheated", "{\"description\":\"too hot\"}");
+        webthing_thing_set_event_capacity(thing, NULL, 100);
+        for (int i = 0; i < 20000; i++) {
+            webthing_thing_add_event(thing, webthing_event_new("overheated", "102"));
+        }
+        long rss = rss_kb();
+        for (int i = 0; i < 200000; i++) {
+            webthing_thing_add_event(thing, webthing_event_new("overheated", "102"));
+        }
+        assert(rss_kb() - rss < 1024);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
+        webthing_thing_set_action_retention(thing, 2, 0);
+        char* ids[3] = {"retain-1", "retain-2", "retain-3"};
+        for (int i = 0; i < 3; i++) {
+            webthing_action* action = webthing_action_new(ids[i], "fadeoff", NULL, lock, action_perform, action_cancel);
+            webthing_thing_add_action(thing, action, NULL);
+        }
+        action_cancel_feedback = false;
+        for (int i = 0; i < 3; i++) {
+            webthing_thing_finish_action(thing, "fadeoff", ids[i]);
+        }
+        assert(!action_cancel_feedback);
+        assert(webthing_thing_get_action(thing, "fadeoff", "retain-1") == NULL);
+        webthing_action_lock* alock = webthing_thing_get_action(thing, "fadeoff", "retain-3");
+        assert(alock != NULL);
+        webthing_action_lock_free(alock);
+        assert(webthing_thing_remove_action(thing, "fadeoff", "retain-3"));
+        webthing_thing_add_action(thing, webthing_action_new("retain-4", "fadeoff", NULL, lock, action_perform, action_cancel), NULL);
+        webthing_thing_finish_action(thing, "fadeoff", "retain-4");
+        alock = webthing_thing_get_action(thing, "fadeoff", "retain-2");
+        assert(alock != NULL);
+        webthing_action_lock_free(alock);
+        webthing_thing_set_action_retention(thing, 0, 1);
+        usleep(5000);
+        webthing_thing_set_action_retention(thing, 0, 1);
+        assert(webthing_thing_get_action(thing, "fadeoff", "retain-2") == NULL);
+        assert(webthing_thing_get_action(thing, "fadeoff", "retain-4") == NULL);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_notify_stats stats;
+        assert(!webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        webthing_notify_policy policy = {.min_interval_ms = 60000};
+        webthing_thing_set_notify_policy(thing, "brightness", &policy);
+        for (int i = 0; i < 10; i++) {
+            webthing_thing_property_notify_i64(thing, "brightness", i);
+        }
+        assert(webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        assert(stats.coalesced == 9);
+        assert(stats.dropped == 8);
+        webthing_thing_set_property_i64(thing, "brightness", 20);
+        assert(webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        assert(stats.coalesced == 10);
+        assert(stats.dropped == 9);
+        webthing_thing_set_notify_policy(thing, "brightness", NULL);
+        assert(!webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_notify_policy policy = {.deadband = 1.0, .deadband_relative = 0.0};
+        webthing_thing_set_notify_policy(thing, "brightness", &policy);
+        webthing_notify_stats stats;
+        double values[] = {50.0, 50.4, 50.8, 51.2, 51.2, 50.5, 49.9};
+        for (int i = 0; i < 7; i++) {
+            webthing_thing_property_notify_f64(thing, "brightness", values[i]);
+        }
+        assert(webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        assert(stats.filtered == 4);
+        assert(stats.coalesced == 0);
+        webthing_property* property = webthing_thing_find_property(thing, "brightness");
+        webthing_thing_set_property_i64(thing, "brightness", 49);
+        int64_t value;
+        assert(webthing_property_get_value_i64(property, &value));
+        assert(value == 49);
+        assert(webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        assert(stats.filtered == 5);
+        policy.deadband = 0.0;
+        policy.deadband_relative = 0.1;
+        webthing_thing_set_notify_policy(thing, "brightness", &policy);
+        webthing_thing_property_notify_i64(thing, "brightness", 55);
+        webthing_thing_property_notify_i64(thing, "brightness", 56);
+        assert(webthing_thing_get_notify_stats(thing, "brightness", &stats));
+        assert(stats.filtered == 6);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_thing_add_subscriber(thing, "ws-1");
+        webthing_thing_add_subscriber(thing, "ws-2");
+        webthing_thing_property_notify_i64(thing, "brightness", 10);
+        webthing_thing_add_subscriber(thing, "ws-3");
+        webthing_thing_property_notify_i64(thing, "brightness", 20);
+        webthing_str_arr* arr = webthing_thing_drain_queue(thing, "ws-1");
+        assert(arr->len == 2);
+        assert(strcmp(arr->ptr[0], "{\"data\":{\"brightness\":10},\"messageType\":\"propertyStatus\"}") == 0);
+        assert(strcmp(arr->ptr[1], "{\"data\":{\"brightness\":20},\"messageType\":\"propertyStatus\"}") == 0);
+        webthing_str_arr_free(arr);
+        arr = webthing_thing_drain_queue(thing, "ws-1");
+        assert(arr->len == 0);
+        webthing_str_arr_free(arr);
+        arr = webthing_thing_drain_queue(thing, "ws-3");
+        assert(arr->len == 1);
+        webthing_str_arr_free(arr);
+        webthing_thing_remove_subscriber(thing, "ws-2");
+        arr = webthing_thing_drain_queue(thing, "ws-2");
+        assert(arr->len == 0);
+        webthing_str_arr_free(arr);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        char* first = webthing_thing_as_thing_description(thing);
+        char* _ = webthing_thing_as_thing_description(thing);
+        assert(strcmp(first, _) == 0);
+        webthing_str_free(_);
+        webthing_property* property = make_number_property();
+        webthing_thing_add_property(thing, property);
+        _ = webthing_thing_as_thing_description(thing);
+        assert(strstr(_, "\"/properties/brightness\"") != NULL);
+        webthing_str_free(_);
+        webthing_property_set_href_prefix(property, "/other");
+        _ = webthing_thing_as_thing_description(thing);
+        assert(strstr(_, "\"/other/properties/brightness\"") != NULL);
+        webthing_str_free(_);
+        webthing_thing_set_href_prefix(thing, "/prefix");
+        _ = webthing_thing_as_thing_description(thing);
+        assert(strstr(_, "\"/prefix/properties/brightness\"") != NULL);
+        webthing_str_free(_);
+        webthing_thing_add_available_event(thing, "overheated", "{\"description\":\"too hot\"}");
+        _ = webthing_thing_as_thing_description(thing);
+        assert(strstr(_, "\"/prefix/events/overheated\"") != NULL);
+        webthing_str_free(_);
+        webthing_thing_remove_property(thing, "brightness");
+        _ = webthing_thing_as_thing_description(thing);
+        assert(strstr(_, "brightness") == NULL);
+        webthing_str_free(_);
+        webthing_str_free(first);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_metrics before = webthing_metrics_snapshot();
+        webthing_thing_add_subscriber(thing, "ws-1");
+        webthing_thing_add_subscriber(thing, "ws-2");
+        assert(webthing_thing_set_property_i64(thing, "brightness", 10) == NULL);
+        webthing_str_free(webthing_thing_get_property(thing, "brightness"));
+        webthing_thing_property_notify_i64(thing, "brightness", 20);
+        webthing_metrics m = webthing_metrics_snapshot();
+        assert(m.property_writes - before.property_writes == 1);
+        assert(m.property_reads - before.property_reads == 1);
+        assert(m.subscribers - before.subscribers == 2);
+        assert(m.notifications - before.notifications == 2);
+        assert(m.notify_fanout - before.notify_fanout == 4);
+        assert(m.notify_fanout_max >= 2);
+        webthing_thing_remove_subscriber(thing, "ws-1");
+        assert(webthing_metrics_snapshot().subscribers - before.subscribers == 1);
+
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_thing_unlock_read(webthing_thing_lock_read(lock));
+        webthing_thing_unlock_write(webthing_thing_lock_write(lock));
+        m = webthing_metrics_snapshot();
+        assert(m.lock_read_waits - before.lock_read_waits == 1);
+        assert(m.lock_write_waits - before.lock_write_waits == 1);
+
+        char* text = webthing_metrics_render();
+        assert(strstr(text, "# TYPE webthing_property_writes_total counter\n") != NULL);
+        assert(strstr(text, "\nwebthing_subscribers ") != NULL);
+        webthing_str_free(text);
+
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server_options options = {.metrics = true};
+        webthing_server* server = webthing_server_spawn_single(lock, 8893, NULL, NULL, &gen, NULL, true, &options);
+        assert(server != NULL);
+        assert(http_get(8893, "/properties") == 200);
+        assert(http_get(8893, "/metrics") == 200);
+        text = webthing_metrics_render();
+        assert(strstr(text, "# TYPE webthing_http_requests_total counter\n") != NULL);
+        assert(strstr(text, "\nwebthing_http_requests_total{route=\"properties\"} 0\n") == NULL);
+        assert(strstr(text, "\nwebthing_http_requests_total{route=\"metrics\"} 0\n") == NULL);
+        webthing_str_free(text);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_latencies before = webthing_metrics_latencies(NULL);
+        webthing_property* property = make_number_property();
+        char* _ = webthing_property_set_value(property, "100");
+        assert(_ == NULL);
+        webthing_property_free(property);
+        assert(webthing_metrics_latencies(NULL).set_value.count - before.set_value.count == 1);
+
+        webthing_thing_lock* lock = webthing_thing_lock_new(make_thing());
+        webthing_action* action = webthing_action_new("slow-1", "slow", NULL, lock, action_perform_slow, NULL);
+        webthing_action_perform(action);
+        webthing_action_finish(action);
+        webthing_action_finish(action);
+        webthing_latencies l = webthing_metrics_latencies("slow");
+        assert(l.perform_action.count == 1);
+        assert(l.perform_action.p50_ns >= 2000000);
+        assert(l.perform_action.p50_ns <= l.perform_action.max_ns);
+        assert(l.perform_action.total_ns == l.perform_action.max_ns);
+        assert(l.queued.count == 1);
+        assert(l.running.count == 1);
+        assert(l.running.p50_ns >= l.perform_action.p50_ns * 15 / 16);
+        assert(l.total.count == 1);
+        assert(l.total.max_ns >= l.running.max_ns);
+        assert(l.generate.count == 0);
+        assert(webthing_metrics_latencies(NULL).perform_action.count - before.perform_action.count == 1);
+        assert(webthing_metrics_latencies("unknown").total.count == 0);
+
+        _ = webthing_metrics_render();
+        assert(strstr(_, "webthing_callback_seconds_count{stage=\"set_value\"}") != NULL);
+        webthing_str_free(_);
+        webthing_action_free(action);
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_value_forwarder forwarder = {.set_value_async = number_set_value_async};
+        webthing_property* property = webthing_property_new("brightness", "50", &forwarder, NULL);
+        char* _ = webthing_property_set_value(property, "70");
+        assert(_ == NULL);
+        _ = webthing_property_get_value(property);
+        assert(strcmp(_, "70") == 0);
+        webthing_str_free(_);
+
+        webthing_thing* thing = make_thing_without();
+        webthing_thing_add_property(thing, property);
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8894, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        assert(http_request(8894, "PUT", "/properties/brightness", "{\"brightness\":30}") == 200);
+        webthing_thing_read_lock* guard = webthing_thing_lock_read(lock);
+        _ = webthing_thing_get_property(guard->thing, "brightness");
+        assert(strcmp(_, "30") == 0);
+        webthing_str_free(_);
+        webthing_thing_unlock_read(guard);
+        assert(http_request(8894, "PUT", "/properties/brightness", "{}") == 400);
+        assert(http_request(8894, "PUT", "/properties/unknown", "{\"unknown\":1}") == 404);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing_lock* locks[3];
+        for (int i = 0; i < 3; i++) {
+            char id[32];
+            snprintf(id, sizeof(id), "urn:dev:ops:registry-%d", i);
+            webthing_thing* thing = webthing_thing_new(id, "Registry", 0, 0);
+            webthing_thing_add_property(thing, make_number_property());
+            locks[i] = webthing_thing_lock_new(thing);
+        }
+        webthing_thing_lock_arr things = {.ptr = (webthing_thing**) locks, .len = 3};
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server_options options = {.snapshot_reads = true};
+        webthing_server* server = webthing_server_spawn_multiple(&things, "Registry", 8895, NULL, NULL, &gen, NULL, true, &options);
+        assert(server != NULL);
+        assert(http_get(8895, "/1/properties") == 200);
+        assert(http_get(8895, "/urn:dev:ops:registry-2/properties") == 200);
+        assert(http_get(8895, "/3/properties") == 404);
+        assert(http_get(8895, "/urn:dev:ops:unknown/properties") == 404);
+        assert(http_get(8895, "/urn:dev:ops:registry-2/properties/brightness") == 200);
+        assert(http_get(8895, "/urn:dev:ops:registry-2/properties/unknown") == 404);
+        char response[4096];
+        assert(http_exchange(8895, "GET", "/?offset=1&limit=1", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "urn:dev:ops:registry-1") != NULL);
+        assert(strstr(response, "urn:dev:ops:registry-2") == NULL);
+        assert(strncmp(http_header(response, "Link"), "</?offset=2&limit=1>; rel=\"next\"", 32) == 0);
+        assert(http_exchange(8895, "GET", "/?offset=2&limit=1", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "urn:dev:ops:registry-2") != NULL);
+        assert(*http_header(response, "Link") == 0);
+        assert(http_get(8895, "/?limit=0") == 400);
+        assert(http_request(8895, "PUT", "/urn:dev:ops:registry-0/properties/brightness", "{\"brightness\":10}") == 200);
+        webthing_thing_read_lock* guard = webthing_thing_lock_read(locks[0]);
+        char* _ = webthing_thing_get_property(guard->thing, "brightness");
+        assert(strcmp(_, "10") == 0);
+        webthing_str_free(_);
+        webthing_thing_unlock_read(guard);
+        assert(webthing_server_stop(server, 1000));
+        for (int i = 0; i < 3; i++) {
+            webthing_thing_lock_free(locks[i]);
+        }
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing_lock* locks[1] = {webthing_thing_lock_new(make_thing())};
+        webthing_thing_lock_arr things = {.ptr = (webthing_thing**) locks, .len = 1};
+        webthing_action_generator gen = {.generate = action_generate};
+        webthing_server* server = webthing_server_spawn_multiple(&things, "Churn", 8896, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        pthread_t threads[4];
+        struct http_load_args args[4];
+        for (int i = 0; i < 4; i++) {
+            args[i] = (struct http_load_args) {.port = 8896, .path = "/0/properties", .ok = 0};
+            pthread_create(&threads[i], NULL, http_load, &args[i]);
+        }
+        for (int i = 0; i < 20; i++) {
+            char id[32], path[64];
+            snprintf(id, sizeof(id), "urn:dev:ops:churn-%d", i);
+            webthing_thing* thing = webthing_thing_new(id, "Churn", 0, 0);
+            webthing_thing_add_property(thing, make_number_property());
+            webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\"}");
+            webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+            int index = webthing_server_add_thing(server, lock);
+            assert(index == i + 1);
+            assert(webthing_server_add_thing(server, lock) == -1);
+            snprintf(path, sizeof(path), "/%d/properties/brightness", index);
+            assert(http_get(8896, path) == 200);
+            snprintf(path, sizeof(path), "/%s", id);
+            assert(http_get(8896, path) == 200);
+            snprintf(path, sizeof(path), "/%s/properties/brightness", id);
+            assert(http_get(8896, path) == 200);
+            snprintf(path, sizeof(path), "/%d/actions/fadeoff", index);
+            assert(http_request(8896, "POST", path, "{\"fadeoff\":{}}") == 201);
+            assert(http_get(8896, path) == 200);
+            if (i == 0) {
+                char response[1024], href[128];
+                assert(http_exchange(8896, "POST", path, "", "{\"fadeoff\":{}}", response, sizeof(response)) == 201);
+                assert(sscanf(strstr(http_body(response), "\"href\":\"") + 8, "%127[^\"]", href) == 1);
+                assert(http_request(8896, "DELETE", href, "") == 204);
+                assert(http_request(8896, "DELETE", href, "") == 404);
+                assert(http_get(8896, href) == 404);
+                snprintf(path, sizeof(path), "/%d", index);
+                int fd = ws_connect(8896, path, "");
+                assert(fd >= 0);
+                snprintf(path, sizeof(path), "/%d/properties/brightness", index);
+                assert(http_request(8896, "PUT", path, "{\"brightness\":30}") == 200);
+                unsigned char payload[125];
+                size_t len;
+                assert(ws_read(fd, payload, &len) == 0x1);
+                assert(contains_bytes(payload, len, "\"propertyStatus\"", 16));
+                close(fd);
+            }
+            assert(webthing_server_remove_thing(server, id));
+            assert(!webthing_server_remove_thing(server, id));
+            snprintf(path, sizeof(path), "/%d/properties", index);
+            assert(http_get(8896, path) == 404);
+            snprintf(path, sizeof(path), "/%d/actions", index);
+            assert(http_request(8896, "POST", path, "{\"fadeoff\":{}}") == 404);
+            webthing_thing_lock_free(lock);
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            assert(args[i].ok == 50);
+        }
+        assert(http_get(8896, "/urn:dev:ops:my-lamp-1234/properties") == 200);
+        assert(webthing_server_remove_thing(server, "urn:dev:ops:my-lamp-1234"));
+        assert(http_get(8896, "/0/properties") == 404);
+        assert(http_get(8896, "/0") == 404);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(locks[0]);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing_without();
+        webthing_thing_add_property(thing, make_number_property());
+        uint8_t expected[] = {0xa1, 0x6a, 'b', 'r', 'i', 'g', 'h', 't', 'n', 'e', 's', 's', 0x18, 0x32};
+        uint8_t buf[32] = {0};
+        assert(webthing_thing_get_properties_cbor(thing, NULL, 0) == sizeof(expected));
+        assert(webthing_thing_get_properties_cbor(thing, buf, 4) == sizeof(expected));
+        assert(memcmp(buf, expected, 4) == 0 && buf[4] == 0);
+        assert(webthing_thing_get_properties_cbor(thing, buf, sizeof(buf)) == sizeof(expected));
+        assert(memcmp(buf, expected, sizeof(expected)) == 0);
+        webthing_thing_free(thing);
+
+        thing = make_thing_without();
+        webthing_thing_add_property(thing, webthing_property_new("t", "-21.5", NULL, NULL));
+        uint8_t single[] = {0xa1, 0x61, 't', 0xfa, 0xc1, 0xac, 0x00, 0x00};
+        assert(webthing_thing_get_properties_cbor(thing, buf, sizeof(buf)) == sizeof(single));
+        assert(memcmp(buf, single, sizeof(single)) == 0);
+        webthing_thing_free(thing);
+
+        thing = make_thing_without();
+        webthing_thing_add_property(thing, webthing_property_new("o", "-300", NULL, NULL));
+        uint8_t negative[] = {0xa1, 0x61, 'o', 0x39, 0x01, 0x2b};
+        assert(webthing_thing_get_properties_cbor(thing, buf, sizeof(buf)) == sizeof(negative));
+        assert(memcmp(buf, negative, sizeof(negative)) == 0);
+        webthing_thing_free(thing);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = blocking_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8897, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        webthing_action_pool_configure(4, 1);
+        webthing_action_pool_set_limit("fadeoff", 1);
+        __atomic_store_n(&pool_release, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pool_mutex);
+        pool_done = 0;
+        pthread_mutex_unlock(&pool_mutex);
+        assert(http_request(8897, "POST", "/actions", "{\"fadeoff\":{}}") == 201);
+        while (pool_get(&pool_active) != 1) {
+            usleep(1000);
+        }
+        assert(http_request(8897, "POST", "/actions/fadeoff", "{\"fadeoff\":{}}") == 201);
+        char response[512];
+        assert(http_exchange(8897, "POST", "/actions", "", "{\"fadeoff\":{}}", response, sizeof(response)) == 503);
+        assert(strncmp(http_header(response, "Retry-After"), "1\r\n", 3) == 0);
+        assert(http_request(8897, "POST", "/actions/fadeoff", "{\"unknown\":{}}") == 400);
+        __atomic_store_n(&pool_release, true, __ATOMIC_SEQ_CST);
+        while (pool_get(&pool_done) != 2) {
+            usleep(1000);
+        }
+        assert(http_request(8897, "POST", "/actions", "{\"fadeoff\":{}}") == 201);
+        webthing_action_pool_set_limit("fadeoff", 0);
+        webthing_action_pool_configure(4, 64);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_available_event(thing, "overheated", "{\"description\":\"too hot\"}");
+        webthing_thing_add_available_event(thing, "cooled", "{\"description\":\"cool again\"}");
+        char data[16];
+        for (int i = 0; i < 3; i++) {
+            snprintf(data, sizeof(data), "%d", i);
+            webthing_thing_add_event(thing, webthing_event_new("overheated", data));
+            webthing_thing_add_event(thing, webthing_event_new("cooled", data));
+        }
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8898, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        char response[2048];
+        assert(http_exchange(8898, "GET", "/events?since=0&limit=2", "", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "X-Last-Event"), "2\r\n", 3) == 0);
+        assert(strstr(response, "[{\"overheated\":{\"data\":0,") != NULL);
+        assert(strstr(response, "{\"cooled\":{\"data\":0,") != NULL);
+        assert(strstr(response, "\"data\":1,") == NULL);
+        assert(http_exchange(8898, "GET", "/events/cooled?since=2", "", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "X-Last-Event"), "6\r\n", 3) == 0);
+        assert(strstr(response, "[{\"cooled\":{\"data\":1,") != NULL);
+        assert(strstr(response, "{\"cooled\":{\"data\":2,") != NULL);
+        assert(strstr(response, "overheated") == NULL);
+        assert(http_exchange(8898, "GET", "/events?since=6", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "\r\n\r\n[]") != NULL);
+        assert(http_get(8898, "/events?since=x") == 400);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing();
+        webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_thing_set_action_retention(thing, 0, 50);
+        webthing_thing_add_action(thing, webthing_action_new("expire-1", "fadeoff", NULL, lock, action_perform, NULL), NULL);
+        webthing_thing_finish_action(thing, "fadeoff", "expire-1");
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8899, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        char response[1024];
+        assert(http_exchange(8899, "GET", "/actions", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "expire-1") != NULL);
+        assert(http_get(8899, "/actions/fadeoff/expire-1") == 200);
+        usleep(60000);
+        assert(http_exchange(8899, "GET", "/actions/fadeoff", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "\r\n\r\n[]") != NULL);
+        assert(http_get(8899, "/actions/fadeoff/expire-1") == 404);
+        webthing_thing_read_lock* guard = webthing_thing_lock_read(lock);
+        assert(webthing_thing_get_action(guard->thing, "fadeoff", "expire-1") == NULL);
+        webthing_thing_unlock_read(guard);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_value_forwarder forwarder = {.set_value_async = number_set_value_held};
+        webthing_thing* thing = make_thing_without();
+        webthing_thing_add_property(thing, webthing_property_new("brightness", "50", &forwarder, NULL));
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8887, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        assert(http_request(8887, "PUT", "/properties/brightness", "{\"brightness\":40}") == 504);
+        assert(number_value_held());
+        complete_held_value(0);
+        held_completed = false;
+        assert(http_get(8887, "/properties/brightness") == 200);
+        webthing_thing_read_lock* guard = webthing_thing_lock_read(lock);
+        char* _ = webthing_thing_get_property(guard->thing, "brightness");
+        assert(strcmp(_, "50") == 0);
+        webthing_str_free(_);
+        webthing_thing_unlock_read(guard);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_value_forwarder forwarder = {.set_value_async = number_set_value_held};
+        webthing_thing* thing = make_thing_without();
+        webthing_thing_add_property(thing, webthing_property_new("brightness", "50", &forwarder, NULL));
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = no_action_generate};
+        webthing_server_options options = {.cpu_affinity = 1};
+        webthing_server* server = webthing_server_spawn_single(lock, 8890, NULL, NULL, &gen, NULL, true, &options);
+        assert(server != NULL);
+        int put_status = 0;
+        pthread_t put, timeout;
+        pthread_create(&put, NULL, http_put_brightness, &put_status);
+        while (!number_value_held()) {
+            usleep(1000);
+        }
+        // Completes the token anyway should the GET be stuck behind the PUT.
+        pthread_create(&timeout, NULL, complete_held_value, (void*) 2000000);
+        pthread_detach(timeout);
+        char response[512];
+        assert(http_exchange(8890, "GET", "/properties", "", "", response, sizeof(response)) == 200);
+        pthread_mutex_lock(&held_mutex);
+        assert(!held_completed);
+        pthread_mutex_unlock(&held_mutex);
+        assert(strstr(response, "{\"brightness\":50}") != NULL);
+        complete_held_value(0);
+        pthread_join(put, NULL);
+        assert(put_status == 200);
+        assert(http_exchange(8890, "GET", "/properties", "", "", response, sizeof(response)) == 200);
+        assert(strstr(response, "{\"brightness\":40}") != NULL);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
+
+    {
+        webthing_thing* thing = make_thing_without();
+        webthing_thing_add_property(thing, make_number_property());
+        webthing_thing_add_available_action(thing, "fadeoff", "{\"title\": \"Fade to Off\",\"description\": \"Fade the lamp to 0% brightness\"}");
+        webthing_thing_lock* lock = webthing_thing_lock_new(thing);
+        webthing_action_generator gen = {.generate = action_generate};
+        webthing_server* server = webthing_server_spawn_single(lock, 8889, NULL, NULL, &gen, NULL, true, NULL);
+        assert(server != NULL);
+        char response[512];
+        assert(http_exchange(8889, "GET", "/properties", "Accept: application/cbor\r\n", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "Content-Type"), "application/cbor", 16) == 0);
+        assert(strcmp(http_body(response), "\xa1\x6a" "brightness\x18\x32") == 0);
+        assert(http_exchange(8889, "PUT", "/properties/brightness", "Accept: application/cbor\r\n", "{\"brightness\":30}", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "Content-Type"), "application/cbor", 16) == 0);
+        assert(strcmp(http_body(response), "\xa1\x6a" "brightness\x18\x1e") == 0);
+        assert(http_exchange(8889, "POST", "/actions", "Accept: application/cbor\r\n", "{\"fadeoff\":{}}", response, sizeof(response)) == 201);
+        assert(strncmp(http_header(response, "Content-Type"), "application/cbor", 16) == 0);
+        assert(http_exchange(8889, "GET", "/properties", "", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "Content-Type"), "application/json", 16) == 0);
+        for (int i = 0; i < 2; i++) {
+            char description[4096];
+            assert(http_exchange(8889, "GET", "/", "", "", description, sizeof(description)) == 200);
+            assert(strncmp(http_header(description, "Content-Type"), "application/json", 16) == 0);
+            assert(strstr(http_body(description), "\"ws://localhost:8889") != NULL);
+        }
+        assert(http_exchange(8889, "GET", "/properties", "Accept: application/cbor;q=0, application/json\r\n", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "Content-Type"), "application/json", 16) == 0);
+        assert(http_exchange(8889, "GET", "/properties", "Accept: application/json;q=0.5, application/cbor\r\n", "", response, sizeof(response)) == 200);
+        assert(strncmp(http_header(response, "Content-Type"), "application/cbor", 16) == 0);
+        assert(http_exchange(8889, "PUT", "/properties/brightness", "Content-Type: application/cbor\r\nAccept: application/cbor\r\n", "\xa1\x6a" "brightness\x18\x23", response, sizeof(response)) == 200);
+        assert(strcmp(http_body(response), "\xa1\x6a" "brightness\x18\x23") == 0);
+        assert(http_request(8889, "PUT", "/properties/brightness", "\xa1\x6a" "brightness\x18\x23") == 400);
+        assert(http_exchange(8889, "POST", "/actions", "Content-Type: application/cbor\r\n", "\xa1\x67" "fadeoff\xa0", response, sizeof(response)) == 201);
+        assert(strstr(http_body(response), "\"fadeoff\"") != NULL);
+
+        int fd = ws_connect(8889, "/", "Accept: application/cbor\r\n");
+        assert(fd >= 0);
+        unsigned char set[] = "\xa2\x6b" "messageType\x6b" "setProperty\x64" "data\xa1\x6a" "brightness\x14";
+        ws_send(fd, 0x2, set, sizeof(set) - 1);
+        unsigned char payload[125];
+        size_t len;
+        assert(ws_read(fd, payload, &len) == 0x2);
+        assert(contains_bytes(payload, len, "\x6e" "propertyStatus", 15));
+        assert(contains_bytes(payload, len, "\xa1\x6a" "brightness\x14", 13));
+        char text[] = "{\"messageType\":\"unknown\",\"data\":{}}";
+        ws_send(fd, 0x1, (unsigned char*) text, strlen(text));
+        assert(ws_read(fd, payload, &len) == 0x2);
+        assert(contains_bytes(payload, len, "\x65" "error", 6));
+        close(fd);
+        assert(webthing_server_stop(server, 1000));
+        webthing_thing_lock_free(lock);
+        counter++;
+    }
+    printf("Test %i successful\n", counter);
 
     printf("\nAll %i tests have passed!\n", counter);
 
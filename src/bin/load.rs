@@ -0,0 +1,860 @@
+// Loopback load generator. Starts a multiple-things server through the C API
+// with K synthetic things, drives it over plain TCP from client threads and
+// reports throughput and latency histograms per workload.
+//
+// Usage: webthing-load [--things K] [--port P] [--duration SECONDS]
+//                      [--connections C] [--get RATE] [--put RATE]
+//                      [--action RATE] [--describe RATE] [--list RATE]
+//                      [--churn RATE] [--ws SUBSCRIBERS] [--snapshot]
+//                      [--fan-out]
+//
+// Rates are total requests per second per workload, 0 disables it. Requests
+// are scheduled open loop and latency is measured from the scheduled send
+// time, so a stalled server shows up as latency instead of fewer samples.
+// --describe requests thing descriptions, --list pages of 100 of them.
+// --churn adds things to the running server, reads their properties and
+// keeps the latest 100 of them, removing older ones.
+// --fan-out replaces the workloads: for 1, 10, 100 and 1000 websocket
+// subscribers of one thing it sends PUT property at the --put rate for
+// --duration and reports the latency of every notification delivered.
+
+#[path = "../lib.rs"]
+#[allow(dead_code)]
+mod ffi;
+
+use std::collections::VecDeque;
+use std::env;
+use std::ffi::CString;
+use std::io::{self, BufRead, BufReader, Read, Write};
+use std::net::TcpStream;
+use std::os::raw::{c_char, c_void};
+use std::process;
+use std::ptr;
+use std::str::FromStr;
+use std::sync::{Arc, Barrier, Mutex, RwLock};
+use std::thread;
+use std::time::{Duration, Instant};
+use webthing::{Action, Property, Thing};
+
+type ThingLock = RwLock<Box<dyn Thing>>;
+
+// Mirrors of the C structs from libwebthing.h
+#[repr(C)]
+struct ThingLockArr {
+    ptr: *mut *mut ThingLock,
+    len: usize,
+}
+
+#[repr(C)]
+struct ActionGenerator {
+    generate: extern "C" fn(
+        thing: *const ThingLock,
+        name: *const c_char,
+        input: *const c_char,
+    ) -> *mut Box<dyn Action>,
+}
+
+#[repr(C)]
+struct ServerOptions {
+    cpu_affinity: u64,
+    snapshot_reads: bool,
+    metrics: bool,
+}
+
+#[repr(C)]
+struct WriteLock {
+    thing: *mut Box<dyn Thing>,
+    _guard: *const c_void,
+}
+
+struct Config {
+    things: usize,
+    port: u16,
+    duration: Duration,
+    connections: usize,
+    get: f64,
+    put: f64,
+    action: f64,
+    describe: f64,
+    list: f64,
+    churn: f64,
+    ws: usize,
+    snapshot: bool,
+    fan_out: bool,
+}
+
+impl Config {
+    fn parse() -> Config {
+        let mut config = Config {
+            things: 10,
+            port: 8888,
+            duration: Duration::from_secs(10),
+            connections: 4,
+            get: 1000.0,
+            put: 100.0,
+            action: 10.0,
+            describe: 0.0,
+            list: 0.0,
+            churn: 0.0,
+            ws: 10,
+            snapshot: false,
+            fan_out: false,
+        };
+        let mut args = env::args().skip(1);
+        while let Some(arg) = args.next() {
+            if arg == "--snapshot" {
+                config.snapshot = true;
+                continue;
+            }
+            if arg == "--fan-out" {
+                config.fan_out = true;
+                continue;
+            }
+            let value = args.next().unwrap_or_else(|| usage(&arg));
+            match arg.as_str() {
+                "--things" => config.things = parse(&arg, &value),
+                "--port" => config.port = parse(&arg, &value),
+                "--duration" => {
+                    config.duration =
+                        Duration::from_secs_f64(parse(&arg, &value))
+                }
+                "--connections" => config.connections = parse(&arg, &value),
+                "--get" => config.get = parse(&arg, &value),
+                "--put" => config.put = parse(&arg, &value),
+                "--action" => config.action = parse(&arg, &value),
+                "--describe" => config.describe = parse(&arg, &value),
+                "--list" => config.list = parse(&arg, &value),
+                "--churn" => config.churn = parse(&arg, &value),
+                "--ws" => config.ws = parse(&arg, &value),
+                _ => usage(&arg),
+            }
+        }
+        if config.things == 0 || config.connections == 0 {
+            usage("--things/--connections");
+        }
+        if config.fan_out && config.put <= 0.0 {
+            usage("--put");
+        }
+        config
+    }
+}
+
+fn parse<T: FromStr>(arg: &str, value: &str) -> T {
+    value.parse().unwrap_or_else(|_| usage(arg))
+}
+
+fn usage(arg: &str) -> ! {
+    eprintln!("Invalid argument {}", arg);
+    eprintln!(
+        "Usage: webthing-load [--things K] [--port P] [--duration SECONDS] \
+         [--connections C] [--get RATE] [--put RATE] [--action RATE] \
+         [--describe RATE] [--list RATE] [--churn RATE] \
+         [--ws SUBSCRIBERS] [--snapshot] [--fan-out]"
+    );
+    process::exit(1);
+}
+
+// Synthetic things
+
+macro_rules! cstr {
+    ( $v:expr ) => {
+        CString::new($v).unwrap()
+    };
+}
+
+extern "C" fn perform(
+    thing: *const ThingLock,
+    action_name: *const c_char,
+    action_id: *const c_char,
+) {
+    let lock =
+        ffi::webthing_thing_lock_write(thing as *mut _) as *mut WriteLock;
+    ffi::webthing_thing_finish_action(
+        unsafe { (*lock).thing },
+        action_name as *mut c_char,
+        action_id as *mut c_char,
+    );
+    ffi::webthing_thing_unlock_write(lock as *mut _);
+    ffi::webthing_thing_lock_free(thing);
+    ffi::webthing_str_free(action_name as *mut c_char);
+    ffi::webthing_str_free(action_id as *mut c_char);
+}
+
+extern "C" fn generate(
+    thing: *const ThingLock,
+    name: *const c_char,
+    input: *const c_char,
+) -> *mut Box<dyn Action> {
+    let action = ffi::webthing_action_new(
+        ptr::null_mut(),
+        name as *mut c_char,
+        input as *mut c_char,
+        thing as *mut _,
+        perform,
+        None,
+    );
+    ffi::webthing_thing_lock_free(thing);
+    ffi::webthing_str_free(name as *mut c_char);
+    if !input.is_null() {
+        ffi::webthing_str_free(input as *mut c_char);
+    }
+    action as *mut _
+}
+
+fn make_thing(i: usize) -> *mut ThingLock {
+    let id = cstr!(format!("urn:dev:ops:load-{}", i));
+    let title = cstr!(format!("Load {}", i));
+    let thing = ffi::webthing_thing_new(
+        id.as_ptr(),
+        title.as_ptr(),
+        ptr::null(),
+        ptr::null(),
+    );
+    let name = cstr!("level");
+    let initial = cstr!("0");
+    let metadata = cstr!("{\"type\":\"number\",\"title\":\"Level\"}");
+    let property = ffi::webthing_property_new(
+        name.as_ptr() as *mut c_char,
+        initial.as_ptr() as *mut c_char,
+        ptr::null_mut(),
+        metadata.as_ptr() as *mut c_char,
+    );
+    ffi::webthing_thing_add_property(
+        thing,
+        property as *mut Box<dyn Property>,
+    );
+    let action = cstr!("fade");
+    let metadata =
+        cstr!("{\"title\":\"Fade\",\"input\":{\"type\":\"object\"}}");
+    ffi::webthing_thing_add_available_action(
+        thing,
+        action.as_ptr() as *mut c_char,
+        metadata.as_ptr() as *mut c_char,
+    );
+    ffi::webthing_thing_lock_new(thing) as *mut _
+}
+
+// HTTP and websocket clients
+
+fn connect(port: u16) -> io::Result<BufReader<TcpStream>> {
+    let stream = TcpStream::connect(("127.0.0.1", port))?;
+    stream.set_nodelay(true)?;
+    Ok(BufReader::new(stream))
+}
+
+fn read_head(
+    stream: &mut BufReader<TcpStream>,
+) -> io::Result<(u16, Vec<String>)> {
+    let mut line = String::new();
+    stream.read_line(&mut line)?;
+    let status = line
+        .split_whitespace()
+        .nth(1)
+        .and_then(|s| s.parse().ok())
+        .ok_or_else(|| {
+        io::Error::new(io::ErrorKind::InvalidData, line.clone())
+    })?;
+    let mut headers = Vec::new();
+    loop {
+        line.clear();
+        if stream.read_line(&mut line)? == 0 {
+            return Err(io::ErrorKind::UnexpectedEof.into());
+        }
+        let header = line.trim_end();
+        if header.is_empty() {
+            return Ok((status, headers));
+        }
+        headers.push(header.to_ascii_lowercase());
+    }
+}
+
+fn request(
+    stream: &mut BufReader<TcpStream>,
+    port: u16,
+    method: &str,
+    path: &str,
+    body: &str,
+) -> io::Result<u16> {
+    write!(
+        stream.get_mut(),
+        "{} {} HTTP/1.1\r\nHost: 127.0.0.1:{}\r\n\
+         Content-Type: application/json\r\nContent-Length: {}\r\n\r\n{}",
+        method,
+        path,
+        port,
+        body.len(),
+        body
+    )?;
+    let (status, headers) = read_head(stream)?;
+    let length = headers
+        .iter()
+        .find_map(|h| h.strip_prefix("content-length:"))
+        .and_then(|l| l.trim().parse::<usize>().ok());
+    if let Some(length) = length {
+        io::copy(&mut stream.take(length as u64), &mut io::sink())?;
+    } else if headers.iter().any(|h| h.contains("chunked")) {
+        let mut line = String::new();
+        loop {
+            line.clear();
+            stream.read_line(&mut line)?;
+            let size = usize::from_str_radix(line.trim(), 16)
+                .map_err(|_| io::Error::from(io::ErrorKind::InvalidData))?;
+            io::copy(&mut stream.take(size as u64 + 2), &mut io::sink())?;
+            if size == 0 {
+                break;
+            }
+        }
+    }
+    Ok(status)
+}
+
+fn read_frame(stream: &mut BufReader<TcpStream>) -> io::Result<(u8, Vec<u8>)> {
+    let mut head = [0u8; 2];
+    stream.read_exact(&mut head)?;
+    let mut length = u64::from(head[1] & 0x7f);
+    if length == 126 {
+        let mut ext = [0u8; 2];
+        stream.read_exact(&mut ext)?;
+        length = u64::from(u16::from_be_bytes(ext));
+    } else if length == 127 {
+        let mut ext = [0u8; 8];
+        stream.read_exact(&mut ext)?;
+        length = u64::from_be_bytes(ext);
+    }
+    let mut payload = Vec::new();
+    stream.take(length).read_to_end(&mut payload)?;
+    Ok((head[0] & 0x0f, payload))
+}
+
+fn write_frame(
+    stream: &mut TcpStream,
+    opcode: u8,
+    payload: &[u8],
+) -> io::Result<()> {
+    // Client frames have to be masked; an all zero key leaves the payload
+    // as is.
+    let mut frame = vec![0x80 | opcode];
+    if payload.len() < 126 {
+        frame.push(0x80 | payload.len() as u8);
+    } else {
+        frame.push(0x80 | 126);
+        frame.extend_from_slice(&(payload.len() as u16).to_be_bytes());
+    }
+    frame.extend_from_slice(&[0, 0, 0, 0]);
+    frame.extend_from_slice(payload);
+    stream.write_all(&frame)
+}
+
+// Reporting
+
+#[derive(Default)]
+struct Stats {
+    latencies: Vec<u64>,
+    errors: u64,
+}
+
+impl Stats {
+    fn merge(&mut self, other: Stats) {
+        self.latencies.extend(other.latencies);
+        self.errors += other.errors;
+    }
+
+    fn report(&mut self, name: &str, elapsed: Duration) {
+        if self.latencies.is_empty() && self.errors == 0 {
+            return;
+        }
+        self.latencies.sort_unstable();
+        let percentile = |p: f64| {
+            let i = (self.latencies.len() as f64 * p) as usize;
+            self.latencies
+                .get(i.min(self.latencies.len().saturating_sub(1)))
+                .copied()
+                .unwrap_or(0)
+        };
+        println!(
+            "{:<24} {:>10.0} ops/s {:>8} errors  p50 {} us  p90 {} us  p99 {} us  p999 {} us  max {} us",
+            name,
+            self.latencies.len() as f64 / elapsed.as_secs_f64(),
+            self.errors,
+            percentile(0.5),
+            percentile(0.9),
+            percentile(0.99),
+            percentile(0.999),
+            self.latencies.last().copied().unwrap_or(0),
+        );
+        // Power of two buckets in microseconds
+        let mut buckets = [0u64; 32];
+        for &latency in &self.latencies {
+            buckets[(64 - latency.leading_zeros() as usize).min(31)] += 1;
+        }
+        let max = buckets.iter().copied().max().unwrap_or(1).max(1);
+        for (i, &count) in buckets.iter().enumerate().filter(|(_, &c)| c > 0) {
+            let upper = if i == 0 { 0 } else { (1u64 << i) - 1 };
+            println!(
+                "    <= {:>9} us {:>9} {}",
+                upper,
+                count,
+                "#".repeat((count * 50 / max) as usize)
+            );
+        }
+    }
+}
+
+// Workloads
+
+#[derive(Clone, Copy)]
+enum Workload {
+    Get,
+    Put,
+    Action,
+    Describe,
+    List,
+}
+
+fn drive(
+    workload: Workload,
+    config: &Config,
+    rate: f64,
+    start: Instant,
+    deadline: Instant,
+) -> Stats {
+    let mut stats = Stats::default();
+    let interval = Duration::from_secs_f64(1.0 / rate);
+    let mut stream = None;
+    for i in 0u32.. {
+        let scheduled = start + interval * i;
+        if scheduled >= deadline {
+            break;
+        }
+        let wait = scheduled.saturating_duration_since(Instant::now());
+        if !wait.is_zero() {
+            thread::sleep(wait);
+        }
+        let thing = i as usize % config.things;
+        let result = match stream.as_mut() {
+            Some(stream) => Ok(stream),
+            None => connect(config.port).map(|s| stream.insert(s)),
+        }
+        .and_then(|stream| match workload {
+            Workload::Get => request(
+                stream,
+                config.port,
+                "GET",
+                &format!("/{}/properties", thing),
+                "",
+            ),
+            Workload::Put => request(
+                stream,
+                config.port,
+                "PUT",
+                &format!("/{}/properties/level", thing),
+                // The value is the send time, websocket subscribers use it
+                // to measure notification latency.
+                &format!("{{\"level\":{}}}", start.elapsed().as_micros()),
+            ),
+            Workload::Action => request(
+                stream,
+                config.port,
+                "POST",
+                &format!("/{}/actions", thing),
+                "{\"fade\":{\"input\":{}}}",
+            ),
+            Workload::Describe => {
+                request(stream, config.port, "GET", &format!("/{}", thing), "")
+            }
+            Workload::List => request(
+                stream,
+                config.port,
+                "GET",
+                &format!(
+                    "/?offset={}&limit=100",
+                    i as usize * 100 % config.things
+                ),
+                "",
+            ),
+        });
+        match result {
+            Ok(status) if status < 400 => {
+                stats.latencies.push(scheduled.elapsed().as_micros() as u64)
+            }
+            Ok(_) => stats.errors += 1,
+            Err(_) => {
+                stats.errors += 1;
+                stream = None;
+            }
+        }
+    }
+    stats
+}
+
+const CHURN_LIVE: usize = 100;
+
+fn churn(
+    server: usize,
+    config: &Config,
+    start: Instant,
+    deadline: Instant,
+) -> Stats {
+    let server = server as *mut ffi::webthing_server;
+    let mut stats = Stats::default();
+    let interval = Duration::from_secs_f64(1.0 / config.churn);
+    let mut live = VecDeque::new();
+    let mut stream = None;
+    for i in 0u32.. {
+        let scheduled = start + interval * i;
+        if scheduled >= deadline {
+            break;
+        }
+        let wait = scheduled.saturating_duration_since(Instant::now());
+        if !wait.is_zero() {
+            thread::sleep(wait);
+        }
+        let lock = make_thing(config.things + i as usize);
+        let index = ffi::webthing_server_add_thing(server, lock as *mut _);
+        if index < 0 {
+            stats.errors += 1;
+            ffi::webthing_thing_lock_free(lock as *mut _);
+            continue;
+        }
+        live.push_back((config.things + i as usize, lock));
+        if live.len() > CHURN_LIVE {
+            let (id, lock) = live.pop_front().unwrap();
+            let id = cstr!(format!("urn:dev:ops:load-{}", id));
+            ffi::webthing_server_remove_thing(server, id.as_ptr());
+            ffi::webthing_thing_lock_free(lock as *mut _);
+        }
+        let result = match stream.as_mut() {
+            Some(stream) => Ok(stream),
+            None => connect(config.port).map(|s| stream.insert(s)),
+        }
+        .and_then(|stream| {
+            request(
+                stream,
+                config.port,
+                "GET",
+                &format!("/{}/properties", index),
+                "",
+            )
+        });
+        match result {
+            Ok(200) => {
+                stats.latencies.push(scheduled.elapsed().as_micros() as u64)
+            }
+            Ok(_) => stats.errors += 1,
+            Err(_) => {
+                stats.errors += 1;
+                stream = None;
+            }
+        }
+    }
+    for (id, lock) in live {
+        let id = cstr!(format!("urn:dev:ops:load-{}", id));
+        ffi::webthing_server_remove_thing(server, id.as_ptr());
+        ffi::webthing_thing_lock_free(lock as *mut _);
+    }
+    stats
+}
+
+fn open_socket(port: u16, thing: usize) -> io::Result<BufReader<TcpStream>> {
+    let mut stream = connect(port)?;
+    write!(
+        stream.get_mut(),
+        "GET /{} HTTP/1.1\r\nHost: 127.0.0.1:{}\r\nUpgrade: websocket\r\n\
+         Connection: Upgrade\r\nSec-WebSocket-Version: 13\r\n\
+         Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n",
+        thing,
+        port
+    )?;
+    match read_head(&mut stream)? {
+        (101, _) => Ok(stream),
+        _ => Err(io::ErrorKind::ConnectionRefused.into()),
+    }
+}
+
+fn subscribe(
+    config: &Config,
+    thing: usize,
+    start: Instant,
+    deadline: Instant,
+) -> Stats {
+    match open_socket(config.port, thing) {
+        Ok(stream) => receive(stream, start, deadline),
+        Err(_) => Stats { errors: 1, ..Stats::default() },
+    }
+}
+
+// Collects the latency of the notifications of PUT property, whose values
+// are the send times in microseconds since start.
+fn receive(
+    mut stream: BufReader<TcpStream>,
+    start: Instant,
+    deadline: Instant,
+) -> Stats {
+    let mut stats = Stats::default();
+    let _ =
+        stream.get_ref().set_read_timeout(Some(Duration::from_millis(100)));
+    while Instant::now() < deadline {
+        match read_frame(&mut stream) {
+            Ok((0x1, payload)) => {
+                let now = start.elapsed().as_micros() as u64;
+                let sent =
+                    serde_json::from_slice::<serde_json::Value>(&payload)
+                        .ok()
+                        .and_then(|m| m["data"]["level"].as_u64());
+                if let Some(sent) = sent {
+                    stats.latencies.push(now.saturating_sub(sent));
+                }
+            }
+            Ok((0x9, payload)) => {
+                if write_frame(stream.get_mut(), 0xa, &payload).is_err() {
+                    stats.errors += 1;
+                    break;
+                }
+            }
+            Ok((0x8, _)) => break,
+            Ok(_) => {}
+            Err(ref e)
+                if e.kind() == io::ErrorKind::WouldBlock
+                    || e.kind() == io::ErrorKind::TimedOut => {}
+            Err(_) => {
+                stats.errors += 1;
+                break;
+            }
+        }
+    }
+    let _ = write_frame(stream.get_mut(), 0x8, &[]);
+    stats
+}
+
+const FAN_OUT: [usize; 4] = [1, 10, 100, 1000];
+
+// Notifications still in flight when the PUTs stop are waited for this long.
+const FAN_OUT_DRAIN: Duration = Duration::from_secs(1);
+
+// All subscribers listen to thing 0. The sockets are opened before the
+// first PUT, so that every subscriber is sent every notification; a
+// notification that does not arrive counts as an error.
+fn fan_out(config: &Config, subscribers: usize) -> Stats {
+    let mut stats = Stats::default();
+    let mut streams = Vec::with_capacity(subscribers);
+    for _ in 0..subscribers {
+        match open_socket(config.port, 0) {
+            Ok(stream) => streams.push(stream),
+            Err(_) => stats.errors += 1,
+        }
+    }
+    let ready = Arc::new(Barrier::new(streams.len() + 1));
+    let start = Instant::now();
+    let deadline = start + config.duration;
+    let receivers: Vec<_> = streams
+        .into_iter()
+        .map(|stream| {
+            let ready = ready.clone();
+            thread::spawn(move || {
+                ready.wait();
+                receive(stream, start, deadline + FAN_OUT_DRAIN)
+            })
+        })
+        .collect();
+    ready.wait();
+    let interval = Duration::from_secs_f64(1.0 / config.put);
+    let mut stream = None;
+    let mut sent = 0;
+    for i in 0u32.. {
+        let scheduled = start + interval * i;
+        if scheduled >= deadline {
+            break;
+        }
+        let wait = scheduled.saturating_duration_since(Instant::now());
+        if !wait.is_zero() {
+            thread::sleep(wait);
+        }
+        let result = match stream.as_mut() {
+            Some(stream) => Ok(stream),
+            None => connect(config.port).map(|s| stream.insert(s)),
+        }
+        .and_then(|stream| {
+            request(
+                stream,
+                config.port,
+                "PUT",
+                "/0/properties/level",
+                &format!("{{\"level\":{}}}", start.elapsed().as_micros()),
+            )
+        });
+        match result {
+            Ok(status) if status < 400 => sent += 1,
+            Ok(_) => stats.errors += 1,
+            Err(_) => {
+                stats.errors += 1;
+                stream = None;
+            }
+        }
+    }
+    let expected = sent * receivers.len() as u64;
+    for receiver in receivers {
+        if let Ok(received) = receiver.join() {
+            stats.merge(received);
+        }
+    }
+    stats.errors += expected.saturating_sub(stats.latencies.len() as u64);
+    stats
+}
+
+// Every subscriber takes a socket on both ends of the loopback connection.
+fn raise_fd_limit() {
+    unsafe {
+        let mut limit: libc::rlimit = std::mem::zeroed();
+        if libc::getrlimit(libc::RLIMIT_NOFILE, &mut limit) == 0 {
+            limit.rlim_cur = limit.rlim_max;
+            libc::setrlimit(libc::RLIMIT_NOFILE, &limit);
+        }
+    }
+}
+
+// Resident set size of this process, server included, in KiB.
+fn rss_kb() -> u64 {
+    let statm =
+        std::fs::read_to_string("/proc/self/statm").unwrap_or_default();
+    let pages: u64 = statm
+        .split_whitespace()
+        .nth(1)
+        .and_then(|pages| pages.parse().ok())
+        .unwrap_or(0);
+    pages * unsafe { libc::sysconf(libc::_SC_PAGESIZE) } as u64 / 1024
+}
+
+fn main() {
+    let config = Arc::new(Config::parse());
+
+    let rss = rss_kb();
+    let startup = Instant::now();
+    let mut locks: Vec<*mut ThingLock> =
+        (0..config.things).map(make_thing).collect();
+    let created = startup.elapsed();
+    let mut things =
+        ThingLockArr { ptr: locks.as_mut_ptr(), len: locks.len() };
+    let mut generator = ActionGenerator { generate };
+    let options = ServerOptions {
+        cpu_affinity: 0,
+        snapshot_reads: config.snapshot,
+        metrics: true,
+    };
+    let name = cstr!("Load");
+    let server = ffi::webthing_server_spawn_multiple(
+        &mut things as *mut ThingLockArr as *mut _,
+        name.as_ptr(),
+        config.port,
+        ptr::null(),
+        ptr::null_mut(),
+        &mut generator as *mut ActionGenerator as *mut _,
+        ptr::null(),
+        true,
+        &options as *const ServerOptions as *const _,
+    );
+    if server.is_null() {
+        eprintln!("Failed to start the server on port {}", config.port);
+        process::exit(1);
+    }
+    while connect(config.port)
+        .and_then(|mut s| {
+            request(&mut s, config.port, "GET", "/0/properties", "")
+        })
+        .map_or(true, |status| status != 200)
+    {
+        thread::sleep(Duration::from_millis(10));
+    }
+    let listening = startup.elapsed() - created;
+    let rss = rss_kb().saturating_sub(rss);
+    println!(
+        "{} things on 127.0.0.1:{}, {} connections per workload, {} websocket subscribers, {:?}",
+        config.things, config.port, config.connections, config.ws, config.duration
+    );
+    println!(
+        "startup: things created in {:.1?}, serving after {:.1?}, {} KiB resident ({} B per thing)",
+        created,
+        listening,
+        rss,
+        rss * 1024 / config.things as u64
+    );
+
+    if config.fan_out {
+        raise_fd_limit();
+        for &subscribers in &FAN_OUT {
+            fan_out(&config, subscribers).report(
+                &format!("notify {} subscribers", subscribers),
+                config.duration,
+            );
+        }
+    } else {
+        workloads(&config, server);
+    }
+
+    ffi::webthing_server_stop(server as *mut _, 5000);
+    for lock in locks {
+        ffi::webthing_thing_lock_free(lock);
+    }
+}
+
+fn workloads(config: &Arc<Config>, server: *const ffi::webthing_server) {
+    let start = Instant::now();
+    let deadline = start + config.duration;
+    let results: Arc<Mutex<Vec<Stats>>> =
+        Arc::new(Mutex::new((0..7).map(|_| Stats::default()).collect()));
+    let mut handles = Vec::new();
+    for (index, workload, rate) in [
+        (0, Workload::Get, config.get),
+        (1, Workload::Put, config.put),
+        (2, Workload::Action, config.action),
+        (3, Workload::Describe, config.describe),
+        (4, Workload::List, config.list),
+    ] {
+        if rate <= 0.0 {
+            continue;
+        }
+        for _ in 0..config.connections {
+            let config = config.clone();
+            let results = results.clone();
+            handles.push(thread::spawn(move || {
+                let rate = rate / config.connections as f64;
+                let stats = drive(workload, &config, rate, start, deadline);
+                results.lock().unwrap()[index].merge(stats);
+            }));
+        }
+    }
+    if config.churn > 0.0 {
+        let config = config.clone();
+        let results = results.clone();
+        let server = server as usize;
+        handles.push(thread::spawn(move || {
+            let stats = churn(server, &config, start, deadline);
+            results.lock().unwrap()[5].merge(stats);
+        }));
+    }
+    for i in 0..config.ws {
+        let config = config.clone();
+        let results = results.clone();
+        handles.push(thread::spawn(move || {
+            let stats = subscribe(&config, i % config.things, start, deadline);
+            results.lock().unwrap()[6].merge(stats);
+        }));
+    }
+    for handle in handles {
+        let _ = handle.join();
+    }
+    let elapsed = start.elapsed();
+
+    let mut results = results.lock().unwrap();
+    let names = [
+        "GET /properties",
+        "PUT property",
+        "POST action",
+        "GET thing description",
+        "GET thing list page",
+        "add thing + GET",
+        "websocket notify",
+    ];
+    for (stats, name) in results.iter_mut().zip(names.iter()) {
+        stats.report(name, elapsed);
+    }
+}
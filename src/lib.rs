@@ -4,13 +4,22 @@
 extern crate libc;
 
 use actix::prelude::*;
+use arc_swap::ArcSwap;
+use futures::channel::oneshot;
+use std::any::Any;
+use std::cell::{Cell, RefCell};
+use std::collections::{HashMap, VecDeque};
+use std::convert::TryFrom;
 use std::ffi::{CStr, CString};
-use std::os::raw::c_char;
-use std::sync::{Arc, RwLock, RwLockReadGuard, RwLockWriteGuard, Weak};
-use std::{
-    mem::{self, MaybeUninit},
-    ptr,
+use std::os::raw::{c_char, c_int};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{
+    mpsc, Arc, Condvar, Mutex, OnceLock, RwLock, RwLockReadGuard,
+    RwLockWriteGuard, Weak,
 };
+use std::thread;
+use std::time::{Duration, Instant};
+use std::{mem, ptr, vec::Drain};
 use uuid::Uuid;
 use webthing::{
     property::ValueForwarder, server::ActionGenerator, Action, BaseAction,
@@ -44,32 +53,59 @@ macro_rules! json_to_cstr {
     };
 }
 
+macro_rules! bool_to_json {
+    ( $v:expr ) => {
+        serde_json::Value::Bool($v)
+    };
+}
+
+macro_rules! i64_to_json {
+    ( $v:expr ) => {
+        serde_json::Value::from($v)
+    };
+}
+
+macro_rules! f64_to_json {
+    ( $v:expr ) => {
+        serde_json::Value::from($v)
+    };
+}
+
+macro_rules! str_to_json {
+    ( $v:expr ) => {
+        serde_json::Value::String(cstr_to_str!($v))
+    };
+}
+
+macro_rules! str_to_buf {
+    ( $v:expr, $buf:expr, $size:expr ) => {{
+        let v: String = $v;
+        if $size > 0 {
+            let len = v.len().min($size - 1);
+            unsafe {
+                ptr::copy_nonoverlapping(v.as_ptr(), $buf.cast::<u8>(), len);
+                *$buf.add(len) = 0;
+            }
+        }
+        v.len() as c_int
+    }};
+}
+
 macro_rules! from_dbox {
     ( $v:expr, $t:tt ) => {{
-        #[allow(invalid_value)]
-        let zerov: Box<dyn $t> =
-            unsafe { MaybeUninit::<Box<dyn $t>>::zeroed().assume_init() };
-        let cpy: *mut Box<dyn $t> = to_box!(zerov);
-        unsafe {
-            ptr::copy_nonoverlapping($v, cpy, 1);
-        }
-        let res = unsafe { Box::from_raw(cpy) };
-        *res
+        let res: Box<dyn $t> = unsafe { ptr::read($v) };
+        res
     }};
 }
 
 macro_rules! undbox {
     ( $v:expr, | $i:ident : $t:tt | $f:expr ) => {{
-        let $i = from_dbox!($v, $t);
-        let res = { $f };
-        mem::forget($i);
-        res
+        let $i: &Box<dyn $t> = unsafe { &*$v };
+        $f
     }};
     ( $v:expr, | mut $i:ident : $t:tt | $f:expr ) => {{
-        let mut $i = from_dbox!($v, $t);
-        let res = { $f };
-        mem::forget($i);
-        res
+        let $i: &mut Box<dyn $t> = unsafe { &mut *$v };
+        $f
     }};
     ( | $i:ident : $t:tt | $f:expr ) => {
         undbox!($i, |$i: $t| $f)
@@ -161,6 +197,165 @@ macro_rules! result_to_cstr {
     };
 }
 
+// CBOR
+
+// Encodes a JSON value as CBOR (RFC 8949). Floats are written in single
+// precision whenever that is lossless, which is where most of the savings
+// over JSON come from for sensor readings.
+fn json_to_cbor(value: &serde_json::Value, out: &mut Vec<u8>) {
+    match value {
+        serde_json::Value::Null => out.push(0xf6),
+        serde_json::Value::Bool(false) => out.push(0xf4),
+        serde_json::Value::Bool(true) => out.push(0xf5),
+        serde_json::Value::Number(n) => match (n.as_u64(), n.as_i64()) {
+            (Some(n), _) => cbor_head(out, 0, n),
+            (None, Some(n)) => cbor_head(out, 1, !n as u64),
+            (None, None) => {
+                let f = n.as_f64().unwrap_or_default();
+                if f as f32 as f64 == f {
+                    out.push(0xfa);
+                    out.extend_from_slice(&(f as f32).to_be_bytes());
+                } else {
+                    out.push(0xfb);
+                    out.extend_from_slice(&f.to_be_bytes());
+                }
+            }
+        },
+        serde_json::Value::String(s) => cbor_text(out, s),
+        serde_json::Value::Array(values) => {
+            cbor_head(out, 4, values.len() as u64);
+            for value in values {
+                json_to_cbor(value, out);
+            }
+        }
+        serde_json::Value::Object(values) => {
+            cbor_head(out, 5, values.len() as u64);
+            for (key, value) in values {
+                cbor_text(out, key);
+                json_to_cbor(value, out);
+            }
+        }
+    }
+}
+
+fn cbor_head(out: &mut Vec<u8>, major: u8, n: u64) {
+    let major = major << 5;
+    if n < 24 {
+        out.push(major | n as u8);
+    } else if n <= u8::MAX as u64 {
+        out.extend_from_slice(&[major | 24, n as u8]);
+    } else if n <= u16::MAX as u64 {
+        out.push(major | 25);
+        out.extend_from_slice(&(n as u16).to_be_bytes());
+    } else if n <= u32::MAX as u64 {
+        out.push(major | 26);
+        out.extend_from_slice(&(n as u32).to_be_bytes());
+    } else {
+        out.push(major | 27);
+        out.extend_from_slice(&n.to_be_bytes());
+    }
+}
+
+fn cbor_text(out: &mut Vec<u8>, s: &str) {
+    cbor_head(out, 3, s.len() as u64);
+    out.extend_from_slice(s.as_bytes());
+}
+
+// Decodes the subset of CBOR json_to_cbor writes, plus half precision
+// floats. Anything else, e.g. byte strings, tags or indefinite lengths, is
+// rejected.
+fn cbor_to_json(input: &[u8]) -> Option<serde_json::Value> {
+    let mut pos = 0;
+    let value = cbor_value(input, &mut pos, 0)?;
+    if pos == input.len() {
+        Some(value)
+    } else {
+        None
+    }
+}
+
+fn cbor_value(
+    input: &[u8],
+    pos: &mut usize,
+    depth: usize,
+) -> Option<serde_json::Value> {
+    if depth > 32 {
+        return None;
+    }
+    let initial = *input.get(*pos)?;
+    *pos += 1;
+    let (major, info) = (initial >> 5, initial & 0x1f);
+    let n = match (major, info) {
+        (7, 20) => return Some(serde_json::Value::Bool(false)),
+        (7, 21) => return Some(serde_json::Value::Bool(true)),
+        (7, 22) => return Some(serde_json::Value::Null),
+        _ => cbor_argument(input, pos, info)?,
+    };
+    Some(match (major, info) {
+        (0, _) => n.into(),
+        (1, _) if n <= i64::MAX as u64 => (!(n as i64)).into(),
+        (1, _) => serde_json::json!(-1.0 - n as f64),
+        (3, _) => {
+            let end = pos.checked_add(usize::try_from(n).ok()?)?;
+            let s = std::str::from_utf8(input.get(*pos..end)?).ok()?;
+            *pos = end;
+            s.into()
+        }
+        (4, _) => {
+            let mut values = Vec::new();
+            for _ in 0..n {
+                values.push(cbor_value(input, pos, depth + 1)?);
+            }
+            serde_json::Value::Array(values)
+        }
+        (5, _) => {
+            let mut values = serde_json::Map::new();
+            for _ in 0..n {
+                let key = match cbor_value(input, pos, depth + 1)? {
+                    serde_json::Value::String(key) => key,
+                    _ => return None,
+                };
+                values.insert(key, cbor_value(input, pos, depth + 1)?);
+            }
+            serde_json::Value::Object(values)
+        }
+        (7, 25) => serde_json::json!(half_to_f64(n as u16)),
+        (7, 26) => serde_json::json!(f32::from_bits(n as u32)),
+        (7, 27) => serde_json::json!(f64::from_bits(n)),
+        _ => return None,
+    })
+}
+
+fn cbor_argument(input: &[u8], pos: &mut usize, info: u8) -> Option<u64> {
+    let len = match info {
+        0..=23 => return Some(info as u64),
+        24 => 1,
+        25 => 2,
+        26 => 4,
+        27 => 8,
+        _ => return None,
+    };
+    let bytes = input.get(*pos..*pos + len)?;
+    *pos += len;
+    Some(bytes.iter().fold(0, |n, b| n << 8 | *b as u64))
+}
+
+fn half_to_f64(half: u16) -> f64 {
+    let exponent = (half >> 10 & 0x1f) as i32;
+    let mantissa = (half & 0x3ff) as f64;
+    let value = match exponent {
+        0 => mantissa * 2f64.powi(-24),
+        31 if mantissa == 0.0 => f64::INFINITY,
+        31 => f64::NAN,
+        _ => (mantissa + 1024.0) * 2f64.powi(exponent - 25),
+    };
+    if half & 0x8000 != 0 {
+        -value
+    } else {
+        value
+    }
+}
+
 // Structs
 
 #[derive(Debug)]
@@ -180,7 +375,9 @@ pub struct webthing_thing_lock_arr {
 #[derive(Debug, Clone)]
 #[repr(C)]
 pub struct webthing_value_forwarder {
-    set_value: extern "C" fn(*const c_char) -> *mut c_char,
+    set_value: Option<extern "C" fn(*const c_char) -> *mut c_char>,
+    set_value_async:
+        Option<extern "C" fn(*mut webthing_value_token, *const c_char)>,
 }
 impl ValueForwarder for webthing_value_forwarder {
     fn set_value(
@@ -188,15 +385,57 @@ impl ValueForwarder for webthing_value_forwarder {
         value: serde_json::Value,
     ) -> Result<serde_json::Value, &'static str> {
         let value = json_to_cstr!(&value);
-        let res = (self.set_value)(value);
-        if ptr::null() == res {
-            Err("Err during set_value")
-        } else {
-            Ok(cstr_to_json!(res))
+        let set_value_async = match (self.set_value_async, self.set_value) {
+            (Some(f), _) => f,
+            (None, Some(f)) => {
+                let start = Instant::now();
+                let res = f(value);
+                metrics().latencies.set_value.record(start.elapsed());
+                return if ptr::null() == res {
+                    Err("Err during set_value")
+                } else {
+                    Ok(cstr_to_json!(res))
+                };
+            }
+            (None, None) => return Err("No value forwarder"),
+        };
+        let (sender, receiver) = oneshot::channel();
+        set_value_async(
+            to_box!(webthing_value_token { sender, start: Instant::now() }),
+            value,
+        );
+        if DEFER_VALUES.with(Cell::get) {
+            // The PUT handler takes over and waits without holding the
+            // thing lock.
+            DEFERRED_VALUE.with(|d| *d.borrow_mut() = Some(receiver));
+            return Err("Value deferred");
+        }
+        match futures::executor::block_on(receiver) {
+            Ok(Some(value)) => Ok(value),
+            _ => Err("Err during set_value"),
         }
     }
 }
 
+thread_local! {
+    // Set while the PUT handler sets a property, so that an asynchronous
+    // value forwarder hands back its pending completion instead of blocking
+    // the worker.
+    static DEFER_VALUES: Cell<bool> = Cell::new(false);
+    static DEFERRED_VALUE: RefCell<Option<ValueReceiver>> = RefCell::new(None);
+}
+
+type ValueReceiver = oneshot::Receiver<Option<serde_json::Value>>;
+
+// How long the server waits for an asynchronous value forwarder to complete
+// a value before giving up on it. The token stays valid until completed.
+const VALUE_TIMEOUT: Duration = Duration::from_secs(5);
+
+pub struct webthing_value_token {
+    sender: oneshot::Sender<Option<serde_json::Value>>,
+    start: Instant,
+}
+
 #[derive(Debug, Clone)]
 #[repr(C)]
 pub struct webthing_action_generator {
@@ -213,11 +452,25 @@ impl ActionGenerator for webthing_action_generator {
         name: String,
         input: Option<&serde_json::Value>,
     ) -> Option<Box<dyn Action>> {
+        Metrics::incr(&metrics().actions_requested);
+        if action_pool().is_full() {
+            Metrics::incr(&metrics().actions_rejected);
+            return None;
+        }
         let thing = Arc::into_raw(thing.upgrade().unwrap());
-        let name = str_to_cstr!(name);
-        let input = from_opt!(json_to_cstr!(input));
-        let res = (self.generate)(thing, name, input);
+        let start = Instant::now();
+        let res = (self.generate)(
+            thing,
+            str_to_cstr!(name.clone()),
+            from_opt!(json_to_cstr!(input)),
+        );
+        metrics().record_action(
+            &metrics().action_latencies_or_default(&name),
+            |l| &l.generate,
+            start.elapsed(),
+        );
         if ptr::null() == res {
+            Metrics::incr(&metrics().actions_rejected);
             None
         } else {
             let action = from_dbox!(res, Action);
@@ -240,8 +493,25 @@ pub struct webthing_action {
             action_id: *const c_char,
         ),
     >,
+    requested: Instant,
+    started: Arc<OnceLock<Instant>>,
+    finished: bool,
+    latencies: Arc<Latencies>,
     _action: BaseAction,
 }
+impl webthing_action {
+    fn job(&self) -> ActionJob {
+        ActionJob {
+            perform_action: self.perform_action,
+            thing: self.get_thing().unwrap(),
+            name: self.get_name(),
+            id: self.get_id(),
+            requested: self.requested,
+            started: Arc::clone(&self.started),
+            latencies: Arc::clone(&self.latencies),
+        }
+    }
+}
 impl Action for webthing_action {
     fn set_href_prefix(&mut self, prefix: String) {
         self._action.set_href_prefix(prefix)
@@ -288,733 +558,4606 @@ impl Action for webthing_action {
     }
 
     fn perform_action(&mut self) {
-        (self.perform_action)(
-            Arc::into_raw(self.get_thing().unwrap()),
-            str_to_cstr!(self.get_name()),
-            str_to_cstr!(self.get_id()),
-        );
+        if DISPATCH_ACTIONS.with(Cell::get) {
+            if !action_pool().submit(self.job()) {
+                Metrics::incr(&metrics().actions_rejected);
+                self.set_status("rejected".to_owned());
+            }
+            return;
+        }
+        self.job().run();
     }
 
     fn cancel(&mut self) {
+        // Completed actions have nothing left to cancel, rejected ones never
+        // ran. This also keeps the eviction of completed actions and the
+        // removal of rejected ones away from the C callback.
+        if self.get_status() == "completed" || self.get_status() == "rejected"
+        {
+            return;
+        }
+        action_pool().cancel(&self.get_id());
         match self.cancel {
             None => self._action.cancel(),
-            Some(f) => f(
-                Arc::into_raw(self.get_thing().unwrap()),
-                str_to_cstr!(self.get_name()),
-                str_to_cstr!(self.get_id()),
-            ),
+            Some(f) => {
+                let start = Instant::now();
+                f(
+                    Arc::into_raw(self.get_thing().unwrap()),
+                    str_to_cstr!(self.get_name()),
+                    str_to_cstr!(self.get_id()),
+                );
+                metrics().record_action(
+                    &self.latencies,
+                    |l| &l.cancel,
+                    start.elapsed(),
+                );
+            }
         }
     }
 
     fn finish(&mut self) {
         self._action.finish();
+        if !self.finished {
+            self.finished = true;
+            let now = Instant::now();
+            if let Some(started) = self.started.get() {
+                let running = now.saturating_duration_since(*started);
+                metrics().record_action(
+                    &self.latencies,
+                    |l| &l.running,
+                    running,
+                );
+            }
+            let total = now.saturating_duration_since(self.requested);
+            metrics().record_action(&self.latencies, |l| &l.total, total);
+        }
     }
 }
 
-#[derive(Debug)]
-#[repr(C)]
-pub struct webthing_ssl_options {
-    a: *const c_char,
-    b: *const c_char,
+thread_local! {
+    // Set while the thing starts an action, so that perform_action hands the
+    // C callback to the action pool instead of running it under the locks.
+    static DISPATCH_ACTIONS: Cell<bool> = Cell::new(false);
 }
-impl webthing_ssl_options {
-    fn convert(self) -> (String, String) {
-        let res = (cstr_to_str!(self.a), cstr_to_str!(self.b));
-        mem::forget(self);
-        res
+
+struct ActionJob {
+    perform_action: extern "C" fn(
+        thing: *const RwLock<Box<dyn Thing>>,
+        action_name: *const c_char,
+        action_id: *const c_char,
+    ),
+    thing: Arc<RwLock<Box<dyn Thing>>>,
+    name: String,
+    id: String,
+    requested: Instant,
+    started: Arc<OnceLock<Instant>>,
+    latencies: Arc<Latencies>,
+}
+impl ActionJob {
+    fn run(self) {
+        let start = Instant::now();
+        let _ = self.started.set(start);
+        let queued = start.saturating_duration_since(self.requested);
+        metrics().record_action(&self.latencies, |l| &l.queued, queued);
+        (self.perform_action)(
+            Arc::into_raw(self.thing),
+            str_to_cstr!(self.name),
+            str_to_cstr!(self.id),
+        );
+        metrics().record_action(
+            &self.latencies,
+            |l| &l.perform_action,
+            start.elapsed(),
+        );
     }
 }
 
-#[repr(C)]
-pub struct webthing_thing_read_lock {
-    thing: *const Box<dyn Thing>,
-    _guard: *const libc::c_void,
+struct ActionPoolState {
+    workers: usize,
+    threads: usize,
+    queue_depth: usize,
+    queue: VecDeque<ActionJob>,
+    running: HashMap<String, usize>,
+    limits: HashMap<String, usize>,
 }
 
-#[repr(C)]
-pub struct webthing_thing_write_lock {
-    thing: *const Box<dyn Thing>,
-    _guard: *const libc::c_void,
+struct ActionPool {
+    state: Mutex<ActionPoolState>,
+    ready: Condvar,
 }
+impl ActionPool {
+    fn is_full(&self) -> bool {
+        let state = self.state.lock().unwrap();
+        state.queue.len() >= state.queue_depth
+    }
 
-#[repr(C)]
-pub struct webthing_action_read_lock {
-    action: *const Box<dyn Action>,
-    _guard: *const libc::c_void,
-}
+    fn submit(&'static self, job: ActionJob) -> bool {
+        let mut state = self.state.lock().unwrap();
+        if state.queue.len() >= state.queue_depth {
+            return false;
+        }
+        state.queue.push_back(job);
+        if state.threads < state.workers {
+            state.threads += 1;
+            thread::spawn(move || self.work());
+        }
+        self.ready.notify_one();
+        true
+    }
 
-#[repr(C)]
-pub struct webthing_action_write_lock {
-    action: *const Box<dyn Action>,
-    _guard: *const libc::c_void,
-}
+    fn cancel(&self, id: &str) -> bool {
+        let mut state = self.state.lock().unwrap();
+        match state.queue.iter().position(|job| job.id == id) {
+            Some(i) => state.queue.remove(i).is_some(),
+            None => false,
+        }
+    }
 
-// Thing functions
+    fn take(state: &mut ActionPoolState) -> Option<ActionJob> {
+        let running = &state.running;
+        let limits = &state.limits;
+        let i = state.queue.iter().position(|job| {
+            match limits.get(&job.name) {
+                Some(limit) => running.get(&job.name).unwrap_or(&0) < limit,
+                None => true,
+            }
+        })?;
+        let job = state.queue.remove(i)?;
+        *state.running.entry(job.name.clone()).or_insert(0) += 1;
+        Some(job)
+    }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_new(
-    id: *const c_char,
-    title: *const c_char,
-    capabilities: *const webthing_str_arr,
-    description: *const c_char,
-) -> *mut Box<dyn Thing> {
-    to_dbox!(
-        BaseThing::new(
-            cstr_to_str!(id),
-            cstr_to_str!(title),
-            to_opt!(webthing_str_arr_to_str_vec!(capabilities)),
-            to_opt!(cstr_to_str!(description)),
-        ),
-        Thing
-    )
+    fn work(&self) {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.threads > state.workers {
+                state.threads -= 1;
+                return;
+            }
+            match Self::take(&mut state) {
+                Some(job) => {
+                    mem::drop(state);
+                    let name = job.name.clone();
+                    job.run();
+                    state = self.state.lock().unwrap();
+                    if let Some(n) = state.running.get_mut(&name) {
+                        *n -= 1;
+                    }
+                    // A job held back by its limit may be runnable now.
+                    self.ready.notify_all();
+                }
+                None => state = self.ready.wait(state).unwrap(),
+            }
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_id(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_id()))
+fn action_pool() -> &'static ActionPool {
+    static POOL: OnceLock<ActionPool> = OnceLock::new();
+    POOL.get_or_init(|| ActionPool {
+        state: Mutex::new(ActionPoolState {
+            workers: 4,
+            threads: 0,
+            queue_depth: 64,
+            queue: VecDeque::new(),
+            running: HashMap::new(),
+            limits: HashMap::new(),
+        }),
+        ready: Condvar::new(),
+    })
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_title(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_title()))
+#[derive(Default)]
+struct WaitStats {
+    count: AtomicU64,
+    total_ns: AtomicU64,
+    max_ns: AtomicU64,
 }
-
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_description(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_description()))
+impl WaitStats {
+    fn record(&self, wait: Duration) {
+        let ns = u64::try_from(wait.as_nanos()).unwrap_or(u64::MAX);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.max_ns.fetch_max(ns, Ordering::Relaxed);
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_as_thing_description(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| json_to_cstr!(&thing.as_thing_description()))
-}
+// Log-linear latency histogram in the spirit of HdrHistogram: every power
+// of two nanoseconds is split into 16 linear sub-buckets, so a recorded
+// value is reported at most 1/16th too high.
+const SUB_BUCKETS: usize = 16;
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_href(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_href()))
+struct Histogram {
+    buckets: Vec<AtomicU64>,
+    count: AtomicU64,
+    total_ns: AtomicU64,
+    max_ns: AtomicU64,
 }
-
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_href_prefix(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_href_prefix()))
+impl Default for Histogram {
+    fn default() -> Self {
+        Histogram {
+            buckets: (0..61 * SUB_BUCKETS)
+                .map(|_| AtomicU64::new(0))
+                .collect(),
+            count: AtomicU64::new(0),
+            total_ns: AtomicU64::new(0),
+            max_ns: AtomicU64::new(0),
+        }
+    }
 }
+impl Histogram {
+    fn index(ns: u64) -> usize {
+        if ns < SUB_BUCKETS as u64 {
+            return ns as usize;
+        }
+        let exp = 63 - ns.leading_zeros() as usize;
+        let sub = (ns >> (exp - 4)) as usize & (SUB_BUCKETS - 1);
+        (exp - 3) * SUB_BUCKETS + sub
+    }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_ui_href(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| {
-        let a = thing.get_ui_href();
-        from_opt!(str_to_cstr!(a))
-    })
-}
+    fn upper_bound(index: usize) -> u64 {
+        if index < SUB_BUCKETS {
+            return index as u64;
+        }
+        let shift = index / SUB_BUCKETS - 1;
+        let sub = (index % SUB_BUCKETS + SUB_BUCKETS) as u64;
+        ((sub + 1) << shift) - 1
+    }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_context(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| str_to_cstr!(thing.get_context()))
-}
+    fn record(&self, elapsed: Duration) {
+        let ns = u64::try_from(elapsed.as_nanos()).unwrap_or(u64::MAX);
+        self.buckets[Self::index(ns)].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.max_ns.fetch_max(ns, Ordering::Relaxed);
+    }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_property_descriptions(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| {
-        json_to_cstr!(&thing.get_property_descriptions())
-    })
+    fn snapshot(&self) -> webthing_latency {
+        let count = self.count.load(Ordering::Relaxed);
+        let max = self.max_ns.load(Ordering::Relaxed);
+        let counts: Vec<u64> =
+            self.buckets.iter().map(|b| b.load(Ordering::Relaxed)).collect();
+        let quantile = |q: f64| {
+            let rank = ((count as f64 * q).ceil() as u64).max(1);
+            let mut seen = 0;
+            for (i, n) in counts.iter().enumerate() {
+                seen += n;
+                if seen >= rank {
+                    return Self::upper_bound(i).min(max);
+                }
+            }
+            max
+        };
+        if count == 0 {
+            return webthing_latency::default();
+        }
+        let total = self.total_ns.load(Ordering::Relaxed);
+        webthing_latency {
+            count,
+            total_ns: total,
+            mean_ns: total / count,
+            p50_ns: quantile(0.5),
+            p90_ns: quantile(0.9),
+            p99_ns: quantile(0.99),
+            p999_ns: quantile(0.999),
+            max_ns: max,
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_action_descriptions(
-    thing: *mut Box<dyn Thing>,
-    action_name: *mut c_char,
-) -> *const c_char {
-    undbox!(|thing: Thing| {
-        json_to_cstr!(
-            &thing.get_action_descriptions(to_opt!(cstr_to_str!(action_name)))
-        )
-    })
+#[derive(Default)]
+struct Latencies {
+    set_value: Histogram,
+    generate: Histogram,
+    perform_action: Histogram,
+    cancel: Histogram,
+    queued: Histogram,
+    running: Histogram,
+    total: Histogram,
+}
+impl Latencies {
+    fn snapshot(&self) -> webthing_latencies {
+        webthing_latencies {
+            set_value: self.set_value.snapshot(),
+            generate: self.generate.snapshot(),
+            perform_action: self.perform_action.snapshot(),
+            cancel: self.cancel.snapshot(),
+            queued: self.queued.snapshot(),
+            running: self.running.snapshot(),
+            total: self.total.snapshot(),
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_event_descriptions(
-    thing: *mut Box<dyn Thing>,
-    event_name: *mut c_char,
-) -> *const c_char {
-    undbox!(|thing: Thing| {
-        json_to_cstr!(
-            &thing.get_event_descriptions(to_opt!(cstr_to_str!(event_name)))
-        )
-    })
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct webthing_latency {
+    count: u64,
+    total_ns: u64,
+    mean_ns: u64,
+    p50_ns: u64,
+    p90_ns: u64,
+    p99_ns: u64,
+    p999_ns: u64,
+    max_ns: u64,
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_properties(
-    thing: *mut Box<dyn Thing>,
-) -> *const c_char {
-    undbox!(|thing: Thing| json_to_cstr!(&thing.get_properties()))
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct webthing_latencies {
+    set_value: webthing_latency,
+    generate: webthing_latency,
+    perform_action: webthing_latency,
+    cancel: webthing_latency,
+    queued: webthing_latency,
+    running: webthing_latency,
+    total: webthing_latency,
+}
+impl webthing_latencies {
+    // Prometheus summaries, in seconds like the other durations
+    fn render(&self) -> String {
+        let mut res = String::from(
+            "# HELP webthing_callback_seconds Latency of C callbacks and \
+             action lifecycle stages\n\
+             # TYPE webthing_callback_seconds summary\n",
+        );
+        let latencies = [
+            ("set_value", &self.set_value),
+            ("generate", &self.generate),
+            ("perform_action", &self.perform_action),
+            ("cancel", &self.cancel),
+            ("action_queued", &self.queued),
+            ("action_running", &self.running),
+            ("action_total", &self.total),
+        ];
+        for (stage, latency) in &latencies {
+            for (quantile, ns) in &[
+                ("0.5", latency.p50_ns),
+                ("0.9", latency.p90_ns),
+                ("0.99", latency.p99_ns),
+                ("0.999", latency.p999_ns),
+            ] {
+                res.push_str(&format!(
+                    "webthing_callback_seconds{{stage=\"{}\",quantile=\"{}\"}} {}\n",
+                    stage,
+                    quantile,
+                    *ns as f64 / 1e9
+                ));
+            }
+            res.push_str(&format!(
+                "webthing_callback_seconds_sum{{stage=\"{}\"}} {}\n\
+                 webthing_callback_seconds_count{{stage=\"{}\"}} {}\n",
+                stage,
+                latency.total_ns as f64 / 1e9,
+                stage,
+                latency.count
+            ));
+        }
+        res
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_capabilities(
-    thing: *mut Box<dyn Thing>,
-) -> *const webthing_str_arr {
-    undbox!(|thing: Thing| {
-        to_box!(str_vec_to_webthing_str_arr!(thing.get_type()))
-    })
+// The routes of this library, counted by Metrics::request. The names are
+// the route labels of webthing_http_requests_total.
+#[derive(Clone, Copy)]
+enum Route {
+    Things,
+    Description,
+    Websocket,
+    Properties,
+    PropertyWrite,
+    ActionRequest,
+    ActionCancel,
+    Actions,
+    Events,
+    Cbor,
+    Metrics,
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_get_property(
-    thing: *mut Box<dyn Thing>,
-    property_name: *mut c_char,
-) -> *const c_char {
-    undbox!(|thing: Thing| {
-        json_to_cstr!(&thing.get_property(&cstr_to_str!(property_name)))
-    })
+const ROUTES: [&str; 11] = [
+    "things",
+    "description",
+    "websocket",
+    "properties",
+    "property_write",
+    "action_request",
+    "action_cancel",
+    "actions",
+    "events",
+    "cbor",
+    "metrics",
+];
+
+// Process wide counters. They are only ever added to with relaxed atomics,
+// so instrumenting a hot path costs an uncontended increment.
+#[derive(Default)]
+struct Metrics {
+    property_reads: AtomicU64,
+    property_writes: AtomicU64,
+    description_reads: AtomicU64,
+    actions_requested: AtomicU64,
+    actions_rejected: AtomicU64,
+    actions_completed: AtomicU64,
+    subscribers: AtomicU64,
+    notifications: AtomicU64,
+    notify_fanout: AtomicU64,
+    notify_fanout_max: AtomicU64,
+    lock_read: WaitStats,
+    lock_write: WaitStats,
+    latencies: Latencies,
+    actions: RwLock<HashMap<String, Arc<Latencies>>>,
+    requests: [AtomicU64; ROUTES.len()],
 }
+impl Metrics {
+    fn action_latencies(&self, name: &str) -> Option<Arc<Latencies>> {
+        self.actions.read().unwrap().get(name).cloned()
+    }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_add_property(
-    thing: *mut Box<dyn Thing>,
-    property: *mut Box<dyn Property>,
+    // Only the first action of a type takes the write lock. Actions keep
+    // the histograms of their type, so recording does not look them up.
+    fn action_latencies_or_default(&self, name: &str) -> Arc<Latencies> {
+        match self.action_latencies(name) {
+            Some(latencies) => latencies,
+            None => Arc::clone(
+                self.actions
+                    .write()
+                    .unwrap()
+                    .entry(name.to_owned())
+                    .or_default(),
+            ),
+        }
+    }
+
+    // Records into the process wide histogram as well as into the one of
+    // the action type, so that a slow driver can be told apart.
+    fn record_action(
+        &self,
+        latencies: &Latencies,
+        histogram: fn(&Latencies) -> &Histogram,
+        elapsed: Duration,
+    ) {
+        histogram(&self.latencies).record(elapsed);
+        histogram(latencies).record(elapsed);
+    }
+
+    fn render(&self) -> String {
+        let mut res = self.snapshot().render();
+        res.push_str(
+            "# HELP webthing_http_requests_total Requests answered by the \
+             routes of this library\n\
+             # TYPE webthing_http_requests_total counter\n",
+        );
+        for (route, requests) in ROUTES.iter().zip(&self.requests) {
+            res.push_str(&format!(
+                "webthing_http_requests_total{{route=\"{}\"}} {}\n",
+                route,
+                requests.load(Ordering::Relaxed)
+            ));
+        }
+        res + &self.latencies.snapshot().render()
+    }
+
+    fn request(&self, route: Route) {
+        Self::incr(&self.requests[route as usize]);
+    }
+
+    fn incr(counter: &AtomicU64) {
+        counter.fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn notified(&self, fanout: usize) {
+        Self::incr(&self.notifications);
+        self.notify_fanout.fetch_add(fanout as u64, Ordering::Relaxed);
+        self.notify_fanout_max.fetch_max(fanout as u64, Ordering::Relaxed);
+    }
+
+    fn snapshot(&self) -> webthing_metrics {
+        let load = |counter: &AtomicU64| counter.load(Ordering::Relaxed);
+        let (actions_queued, actions_running) = {
+            let state = action_pool().state.lock().unwrap();
+            (state.queue.len(), state.running.values().sum::<usize>())
+        };
+        webthing_metrics {
+            property_reads: load(&self.property_reads),
+            property_writes: load(&self.property_writes),
+            description_reads: load(&self.description_reads),
+            actions_requested: load(&self.actions_requested),
+            actions_rejected: load(&self.actions_rejected),
+            actions_completed: load(&self.actions_completed),
+            actions_queued: actions_queued as u64,
+            actions_running: actions_running as u64,
+            subscribers: load(&self.subscribers),
+            notifications: load(&self.notifications),
+            notify_fanout: load(&self.notify_fanout),
+            notify_fanout_max: load(&self.notify_fanout_max),
+            lock_read_waits: load(&self.lock_read.count),
+            lock_read_wait_ns: load(&self.lock_read.total_ns),
+            lock_read_wait_max_ns: load(&self.lock_read.max_ns),
+            lock_write_waits: load(&self.lock_write.count),
+            lock_write_wait_ns: load(&self.lock_write.total_ns),
+            lock_write_wait_max_ns: load(&self.lock_write.max_ns),
+        }
+    }
+}
+
+fn metrics() -> &'static Metrics {
+    static METRICS: OnceLock<Metrics> = OnceLock::new();
+    METRICS.get_or_init(Metrics::default)
+}
+
+fn read_thing(
+    thingl: &RwLock<Box<dyn Thing>>,
+) -> RwLockReadGuard<'_, Box<dyn Thing>> {
+    let start = Instant::now();
+    let guard = thingl.read().unwrap();
+    metrics().lock_read.record(start.elapsed());
+    guard
+}
+
+fn write_thing(
+    thingl: &RwLock<Box<dyn Thing>>,
+) -> RwLockWriteGuard<'_, Box<dyn Thing>> {
+    let start = Instant::now();
+    let guard = thingl.write().unwrap();
+    metrics().lock_write.record(start.elapsed());
+    guard
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+#[repr(C)]
+pub struct webthing_metrics {
+    property_reads: u64,
+    property_writes: u64,
+    description_reads: u64,
+    actions_requested: u64,
+    actions_rejected: u64,
+    actions_completed: u64,
+    actions_queued: u64,
+    actions_running: u64,
+    subscribers: u64,
+    notifications: u64,
+    notify_fanout: u64,
+    notify_fanout_max: u64,
+    lock_read_waits: u64,
+    lock_read_wait_ns: u64,
+    lock_read_wait_max_ns: u64,
+    lock_write_waits: u64,
+    lock_write_wait_ns: u64,
+    lock_write_wait_max_ns: u64,
+}
+impl webthing_metrics {
+    // Prometheus text exposition format
+    fn render(&self) -> String {
+        let metrics: [(&str, &str, &str, u64); 18] = [
+            (
+                "property_reads_total",
+                "counter",
+                "Property reads",
+                self.property_reads,
+            ),
+            (
+                "property_writes_total",
+                "counter",
+                "Property writes",
+                self.property_writes,
+            ),
+            (
+                "description_reads_total",
+                "counter",
+                "Thing descriptions rendered or served from cache",
+                self.description_reads,
+            ),
+            (
+                "actions_requested_total",
+                "counter",
+                "Actions requested through the action generator",
+                self.actions_requested,
+            ),
+            (
+                "actions_rejected_total",
+                "counter",
+                "Actions refused by the action generator or the action pool",
+                self.actions_rejected,
+            ),
+            (
+                "actions_completed_total",
+                "counter",
+                "Actions finished",
+                self.actions_completed,
+            ),
+            (
+                "actions_queued",
+                "gauge",
+                "Actions waiting for an action pool worker",
+                self.actions_queued,
+            ),
+            (
+                "actions_running",
+                "gauge",
+                "Actions being performed by the action pool",
+                self.actions_running,
+            ),
+            (
+                "subscribers",
+                "gauge",
+                "Websocket subscribers",
+                self.subscribers,
+            ),
+            (
+                "notifications_total",
+                "counter",
+                "Property notifications sent to subscribers",
+                self.notifications,
+            ),
+            (
+                "notify_fanout_total",
+                "counter",
+                "Subscribers reached by property notifications",
+                self.notify_fanout,
+            ),
+            (
+                "notify_fanout_max",
+                "gauge",
+                "Most subscribers reached by a single notification",
+                self.notify_fanout_max,
+            ),
+            (
+                "lock_read_waits_total",
+                "counter",
+                "Thing read locks taken",
+                self.lock_read_waits,
+            ),
+            (
+                "lock_read_wait_seconds_total",
+                "counter",
+                "Time spent waiting for thing read locks",
+                self.lock_read_wait_ns,
+            ),
+            (
+                "lock_read_wait_seconds_max",
+                "gauge",
+                "Longest wait for a thing read lock",
+                self.lock_read_wait_max_ns,
+            ),
+            (
+                "lock_write_waits_total",
+                "counter",
+                "Thing write locks taken",
+                self.lock_write_waits,
+            ),
+            (
+                "lock_write_wait_seconds_total",
+                "counter",
+                "Time spent waiting for thing write locks",
+                self.lock_write_wait_ns,
+            ),
+            (
+                "lock_write_wait_seconds_max",
+                "gauge",
+                "Longest wait for a thing write lock",
+                self.lock_write_wait_max_ns,
+            ),
+        ];
+        let mut res = String::new();
+        for (name, kind, help, value) in &metrics {
+            res.push_str(&format!(
+                "# HELP webthing_{} {}\n# TYPE webthing_{} {}\n",
+                name, help, name, kind
+            ));
+            if name.contains("seconds") {
+                res.push_str(&format!(
+                    "webthing_{} {}\n",
+                    name,
+                    *value as f64 / 1e9
+                ));
+            } else {
+                res.push_str(&format!("webthing_{} {}\n", name, value));
+            }
+        }
+        res
+    }
+}
+
+// Every property has a slot of its own, so that publishing a value only
+// swaps that slot. The list of slots is copied, as a list of pointers, when
+// properties are added or removed or a batch of values is published. Slots
+// are sorted by name like the keys of serde_json::Map. Both the list and the
+// values are swapped atomically, so readers never wait for a lock.
+#[derive(Default)]
+pub struct webthing_property_snapshot {
+    slots: ArcSwap<Vec<Arc<PropertySlot>>>,
+}
+
+struct PropertySlot {
+    name: String,
+    value: ArcSwap<serde_json::Value>,
+}
+impl PropertySlot {
+    fn new(name: String, value: serde_json::Value) -> Arc<Self> {
+        Arc::new(PropertySlot { name, value: ArcSwap::from_pointee(value) })
+    }
+
+    fn load(&self) -> Arc<serde_json::Value> {
+        self.value.load_full()
+    }
+}
+
+impl webthing_property_snapshot {
+    fn slots(&self) -> Arc<Vec<Arc<PropertySlot>>> {
+        self.slots.load_full()
+    }
+
+    fn find(slots: &[Arc<PropertySlot>], name: &str) -> Result<usize, usize> {
+        slots.binary_search_by(|slot| slot.name.as_str().cmp(name))
+    }
+
+    fn load(&self) -> serde_json::Map<String, serde_json::Value> {
+        self.slots()
+            .iter()
+            .map(|slot| (slot.name.clone(), (*slot.load()).clone()))
+            .collect()
+    }
+
+    fn get(&self, name: &str) -> Option<Arc<serde_json::Value>> {
+        let slots = self.slots();
+        Self::find(&slots, name).ok().map(|i| slots[i].load())
+    }
+
+    // Serializes the published values without copying them first.
+    fn to_json(&self) -> String {
+        let mut res = String::from("{");
+        for (i, slot) in self.slots.load().iter().enumerate() {
+            if i > 0 {
+                res.push(',');
+            }
+            res.push_str(&serde_json::to_string(&slot.name).unwrap());
+            res.push(':');
+            res.push_str(
+                &serde_json::to_string(&**slot.value.load()).unwrap(),
+            );
+        }
+        res.push('}');
+        res
+    }
+
+    // Writers adding or removing slots are serialized by the thing's write
+    // lock, so a new list can be built and swapped in without a lock of its
+    // own. Values of existing slots may also be published through property
+    // handles, which only swaps the value.
+    fn publish(&self, name: &str, value: serde_json::Value) {
+        let slots = self.slots();
+        match Self::find(&slots, name) {
+            Ok(i) => slots[i].value.store(Arc::new(value)),
+            Err(i) => {
+                let mut slots = (*slots).clone();
+                slots.insert(i, PropertySlot::new(name.to_owned(), value));
+                self.slots.store(Arc::new(slots));
+            }
+        }
+    }
+
+    // Publishes a batch at once, readers see either none or all of its
+    // values.
+    fn publish_all(
+        &self,
+        values: &serde_json::Map<String, serde_json::Value>,
+    ) {
+        let mut slots = (*self.slots()).clone();
+        for (name, value) in values {
+            let slot = PropertySlot::new(name.clone(), value.clone());
+            match Self::find(&slots, name) {
+                Ok(i) => slots[i] = slot,
+                Err(i) => slots.insert(i, slot),
+            }
+        }
+        self.slots.store(Arc::new(slots));
+    }
+
+    fn remove(&self, name: &str) {
+        let mut slots = (*self.slots()).clone();
+        if let Ok(i) = Self::find(&slots, name) {
+            slots.remove(i);
+            self.slots.store(Arc::new(slots));
+        }
+    }
+}
+
+#[derive(Default)]
+struct EventLog {
+    events: HashMap<String, VecDeque<(u64, Box<dyn Event>)>>,
+    capacity: usize,
+    capacities: HashMap<String, usize>,
+    last: u64,
+}
+impl EventLog {
+    fn capacity(&self, name: &str) -> usize {
+        *self.capacities.get(name).unwrap_or(&self.capacity)
+    }
+
+    fn truncate(&mut self, name: &str) {
+        let capacity = self.capacity(name);
+        if let Some(events) = self.events.get_mut(name) {
+            if capacity != 0 && events.len() > capacity {
+                events.drain(..events.len() - capacity);
+            }
+        }
+    }
+
+    fn set_capacity(&mut self, name: Option<String>, capacity: usize) {
+        match name {
+            Some(name) => {
+                self.capacities.insert(name.clone(), capacity);
+                self.truncate(&name);
+            }
+            None => {
+                self.capacity = capacity;
+                let names: Vec<String> = self.events.keys().cloned().collect();
+                for name in names {
+                    self.truncate(&name);
+                }
+            }
+        }
+    }
+
+    fn push(&mut self, event: Box<dyn Event>) {
+        let name = event.get_name();
+        self.last += 1;
+        let last = self.last;
+        self.events.entry(name.clone()).or_default().push_back((last, event));
+        self.truncate(&name);
+    }
+
+    // Returns the events newer than since in the order they were added,
+    // together with the sequence number of the last one returned.
+    fn range(
+        &self,
+        name: Option<&String>,
+        since: u64,
+        limit: usize,
+    ) -> (Vec<&(u64, Box<dyn Event>)>, u64) {
+        let limit = if limit == 0 { usize::MAX } else { limit };
+        let mut res: Vec<&(u64, Box<dyn Event>)> = Vec::new();
+        for (n, events) in &self.events {
+            if name.map_or(false, |name| name != n) {
+                continue;
+            }
+            let start = events.partition_point(|(seq, _)| *seq <= since);
+            res.extend(events.range(start..).take(limit));
+        }
+        res.sort_by_key(|(seq, _)| *seq);
+        res.truncate(limit);
+        let last = res.last().map_or(since, |(seq, _)| *seq);
+        (res, last)
+    }
+
+    fn descriptions(
+        &self,
+        name: Option<&String>,
+        since: u64,
+        limit: usize,
+    ) -> (serde_json::Value, u64) {
+        let (events, last) = self.range(name, since, limit);
+        let descriptions = events
+            .iter()
+            .map(|(_, event)| {
+                serde_json::Value::Object(event.as_event_description())
+            })
+            .collect();
+        (serde_json::Value::Array(descriptions), last)
+    }
+}
+
+#[derive(Default)]
+struct ActionRetention {
+    max_completed: usize,
+    max_age: Duration,
+    completed: HashMap<String, VecDeque<(String, Instant)>>,
+}
+impl ActionRetention {
+    fn is_enabled(&self) -> bool {
+        self.max_completed != 0 || self.max_age != Duration::default()
+    }
+
+    // Whether the oldest of the completed actions is no longer retained.
+    fn is_expired(
+        &self,
+        completed: &VecDeque<(String, Instant)>,
+        now: Instant,
+    ) -> bool {
+        match completed.front() {
+            None => false,
+            Some((_, time)) => {
+                (self.max_completed != 0
+                    && completed.len() > self.max_completed)
+                    || (self.max_age != Duration::default()
+                        && now.duration_since(*time) > self.max_age)
+            }
+        }
+    }
+
+    fn has_expired(&self, now: Instant) -> bool {
+        self.completed
+            .values()
+            .any(|completed| self.is_expired(completed, now))
+    }
+
+    // Returns the completed actions that are no longer retained.
+    fn expired(&mut self, now: Instant) -> Vec<(String, String)> {
+        let mut res = Vec::new();
+        let mut completed = mem::take(&mut self.completed);
+        for (name, completed) in &mut completed {
+            while self.is_expired(completed, now) {
+                let (id, _) = completed.pop_front().unwrap();
+                res.push((name.clone(), id));
+            }
+        }
+        self.completed = completed;
+        res
+    }
+
+    fn forget(&mut self, name: &str, id: &str) {
+        if let Some(completed) = self.completed.get_mut(name) {
+            completed.retain(|(completed_id, _)| completed_id != id);
+        }
+    }
+}
+
+#[derive(Debug)]
+#[repr(C)]
+pub struct webthing_notify_policy {
+    min_interval_ms: u64,
+    deadband: f64,
+    deadband_relative: f64,
+}
+
+#[derive(Debug, Default)]
+#[repr(C)]
+pub struct webthing_notify_stats {
+    coalesced: u64,
+    dropped: u64,
+    filtered: u64,
+}
+
+#[derive(Default)]
+struct NotifyState {
+    min_interval: Duration,
+    deadband: f64,
+    deadband_relative: f64,
+    last_sent: Option<Instant>,
+    last_value: Option<serde_json::Value>,
+    pending: Option<serde_json::Value>,
+    stats: webthing_notify_stats,
+}
+impl NotifyState {
+    // Whether a change is too small to be worth a notification. Changes are
+    // measured against the last value sent rather than the last value seen,
+    // so a slow drift is still reported once it adds up.
+    fn is_filtered(&self, value: &serde_json::Value) -> bool {
+        let last = match &self.last_value {
+            None => return false,
+            Some(last) => last,
+        };
+        if last == value {
+            return true;
+        }
+        match (last.as_f64(), value.as_f64()) {
+            (Some(last), Some(value)) => {
+                let delta = (value - last).abs();
+                (self.deadband > 0.0 && delta < self.deadband)
+                    || (self.deadband_relative > 0.0
+                        && delta < self.deadband_relative * last.abs())
+            }
+            _ => false,
+        }
+    }
+
+    fn is_due(&self, now: Instant) -> bool {
+        self.last_sent
+            .map_or(true, |t| now.duration_since(t) >= self.min_interval)
+    }
+
+    // Returns the value if it is to be sent right away, otherwise keeps it
+    // until the window is over. The last value wins.
+    fn admit(
+        &mut self,
+        value: serde_json::Value,
+        now: Instant,
+    ) -> Option<serde_json::Value> {
+        if self.is_filtered(&value) {
+            // The value is back within the deadband, so whatever is pending
+            // does not need to be sent either.
+            self.stats.filtered += 1;
+            if self.pending.take().is_some() {
+                self.stats.dropped += 1;
+            }
+            None
+        } else if self.is_due(now) {
+            if self.pending.take().is_some() {
+                self.stats.dropped += 1;
+            }
+            self.last_sent = Some(now);
+            self.last_value = Some(value.clone());
+            Some(value)
+        } else {
+            self.stats.coalesced += 1;
+            if self.pending.replace(value).is_some() {
+                self.stats.dropped += 1;
+            }
+            None
+        }
+    }
+
+    fn flush(&mut self, now: Instant) -> Option<serde_json::Value> {
+        if self.pending.is_some() && self.is_due(now) {
+            self.last_sent = Some(now);
+            self.last_value = self.pending.clone();
+            self.pending.take()
+        } else {
+            None
+        }
+    }
+}
+
+// Messages are serialized once and shared by all subscribers. Each
+// subscriber only keeps a cursor into the log, so notifying is O(1) in the
+// number of subscribers. The websocket sessions take owned strings, so the
+// copy for each of them is made when it drains its queue.
+#[derive(Default)]
+struct MessageLog {
+    messages: VecDeque<Arc<str>>,
+    first: u64,
+    cursors: HashMap<String, (u64, Vec<String>)>,
+}
+impl MessageLog {
+    fn end(&self) -> u64 {
+        self.first + self.messages.len() as u64
+    }
+
+    fn subscribe(&mut self, ws_id: String) -> bool {
+        let end = self.end();
+        self.cursors.insert(ws_id, (end, Vec::new())).is_none()
+    }
+
+    fn unsubscribe(&mut self, ws_id: &str) -> bool {
+        let res = self.cursors.remove(ws_id).is_some();
+        self.trim();
+        res
+    }
+
+    fn push(&mut self, message: String) {
+        if !self.cursors.is_empty() {
+            self.messages.push_back(Arc::from(message));
+        }
+    }
+
+    fn trim(&mut self) {
+        let end = self.end();
+        let min = self.cursors.values().map(|(c, _)| *c).min().unwrap_or(end);
+        while self.first < min {
+            self.messages.pop_front();
+            self.first += 1;
+        }
+    }
+
+    fn drain(&mut self, ws_id: &str) -> Option<Drain<String>> {
+        let end = self.end();
+        let first = self.first;
+        let messages = &self.messages;
+        let (cursor, queue) = self.cursors.get_mut(ws_id)?;
+        let start = (*cursor - first) as usize;
+        queue.extend(messages.range(start..).map(|m| String::from(&**m)));
+        *cursor = end;
+        self.trim();
+        self.cursors.get_mut(ws_id).map(|(_, queue)| queue.drain(..))
+    }
+}
+
+struct ThingDescription {
+    description: serde_json::Map<String, serde_json::Value>,
+    json: String,
+    // The description as served over HTTP, by scheme and host.
+    served: Mutex<Vec<(String, String, actix_web::web::Bytes)>>,
+}
+
+// Hosts are named by the clients, so only so many are cached.
+const SERVED_DESCRIPTIONS: usize = 8;
+
+impl ThingDescription {
+    fn served(
+        &self,
+        scheme: &str,
+        host: &str,
+        href: &str,
+    ) -> actix_web::web::Bytes {
+        let mut served = self.served.lock().unwrap();
+        if let Some((_, _, json)) =
+            served.iter().find(|(s, h, _)| s == scheme && h == host)
+        {
+            return json.clone();
+        }
+        let description =
+            serve_description(self.description.clone(), scheme, host, href);
+        let json = actix_web::web::Bytes::from(
+            serde_json::to_string(&description).unwrap(),
+        );
+        if served.len() < SERVED_DESCRIPTIONS {
+            served.push((scheme.to_owned(), host.to_owned(), json.clone()));
+        }
+        json
+    }
+}
+
+type DescriptionCache = Mutex<Option<Arc<ThingDescription>>>;
+
+// What a property added to a thing updates when it is written through its
+// own handle: the snapshot of the thing, and its description if the hrefs
+// change.
+struct PropertyOwner {
+    name: String,
+    snapshot: Weak<webthing_property_snapshot>,
+    description: Weak<DescriptionCache>,
+}
+
+// The owners of the properties added to a thing, by address of the property.
+fn property_owners() -> &'static RwLock<HashMap<usize, PropertyOwner>> {
+    static OWNERS: OnceLock<RwLock<HashMap<usize, PropertyOwner>>> =
+        OnceLock::new();
+    OWNERS.get_or_init(RwLock::default)
+}
+
+// Publishes the value of a property written through its own handle, if it
+// was added to a thing.
+fn publish_write(
+    res: Result<(), &'static str>,
+    property: &dyn Property,
+) -> Result<(), &'static str> {
+    if res.is_ok() {
+        let owners = property_owners().read().unwrap();
+        if let Some(owner) = owners.get(&property_key(property)) {
+            if let Some(snapshot) = owner.snapshot.upgrade() {
+                snapshot.publish(&owner.name, property.get_value());
+            }
+        }
+    }
+    res
+}
+
+fn property_key(property: &dyn Property) -> usize {
+    property as *const dyn Property as *const () as usize
+}
+
+macro_rules! as_webthing_thing {
+    ( $v:expr ) => {
+        $v.as_mut_any().downcast_mut::<webthing_thing>().unwrap()
+    };
+}
+
+pub struct webthing_thing {
+    subscribers: MessageLog,
+    properties: Vec<(String, Option<*mut dyn Property>)>,
+    snapshot: Arc<webthing_property_snapshot>,
+    events: EventLog,
+    retention: ActionRetention,
+    notify: HashMap<String, NotifyState>,
+    description: Arc<DescriptionCache>,
+    // The lock around this thing, set by webthing_thing_lock_new.
+    this: Weak<RwLock<Box<dyn Thing>>>,
+    _thing: BaseThing,
+}
+// The property pointers only ever point into the boxes owned by _thing.
+unsafe impl Send for webthing_thing {}
+unsafe impl Sync for webthing_thing {}
+impl Drop for webthing_thing {
+    fn drop(&mut self) {
+        let subscribers = self.subscribers.cursors.len() as u64;
+        metrics().subscribers.fetch_sub(subscribers, Ordering::Relaxed);
+        let mut owners = property_owners().write().unwrap();
+        for (_, property) in &self.properties {
+            if let Some(property) = property {
+                owners.remove(&property_key(unsafe { &**property }));
+            }
+        }
+    }
+}
+impl webthing_thing {
+    fn property_index(&self, name: &str) -> c_int {
+        match self
+            .properties
+            .iter()
+            .position(|(n, p)| n == name && p.is_some())
+        {
+            None => -1,
+            Some(i) => i as c_int,
+        }
+    }
+
+    fn property_at(
+        &self,
+        index: c_int,
+    ) -> Result<(&String, *mut dyn Property), &'static str> {
+        usize::try_from(index)
+            .ok()
+            .and_then(|i| self.properties.get(i))
+            .and_then(|(name, property)| property.map(|p| (name, p)))
+            .ok_or("Property not found")
+    }
+
+    fn get_property_at(&self, index: c_int) -> Option<serde_json::Value> {
+        let (_, property) = self.property_at(index).ok()?;
+        Some(unsafe { &*property }.get_value())
+    }
+
+    fn set_property_at(
+        &mut self,
+        index: c_int,
+        value: serde_json::Value,
+    ) -> Result<(), &'static str> {
+        let (name, property) = self.property_at(index)?;
+        let name = name.clone();
+        Metrics::incr(&metrics().property_writes);
+        unsafe { &mut *property }.set_value(value.clone())?;
+        self.property_notify(name, value);
+        Ok(())
+    }
+
+    fn set_cached_value_at(
+        &mut self,
+        index: c_int,
+        value: serde_json::Value,
+    ) -> Result<(), &'static str> {
+        let (name, property) = self.property_at(index)?;
+        unsafe { &mut *property }.set_cached_value(value.clone())?;
+        self.snapshot.publish(&name, value);
+        Ok(())
+    }
+
+    fn property_notify_at(&mut self, index: c_int, value: serde_json::Value) {
+        if let Ok((name, _)) = self.property_at(index) {
+            let name = name.clone();
+            self.property_notify(name, value);
+        }
+    }
+
+    // The description only changes when properties, available actions or
+    // events are added or removed, or when the hrefs change, so it is
+    // rendered once and kept until then.
+    fn thing_description(&self) -> Arc<ThingDescription> {
+        Metrics::incr(&metrics().description_reads);
+        let mut cached = self.description.lock().unwrap();
+        if let Some(description) = &*cached {
+            return Arc::clone(description);
+        }
+        let description = self._thing.as_thing_description();
+        let json = serde_json::to_string(&description).unwrap();
+        let res = Arc::new(ThingDescription {
+            description,
+            json,
+            served: Mutex::default(),
+        });
+        *cached = Some(Arc::clone(&res));
+        res
+    }
+
+    fn invalidate_thing_description(&mut self) {
+        *self.description.lock().unwrap() = None;
+    }
+
+    fn forget_property(&self, name: &str) {
+        if let Some((_, Some(property))) =
+            self.properties.iter().find(|(n, _)| n == name)
+        {
+            let key = property_key(unsafe { &**property });
+            property_owners().write().unwrap().remove(&key);
+        }
+    }
+
+    fn evict_actions(&mut self) {
+        if self.retention.is_enabled() {
+            for (name, id) in self.retention.expired(Instant::now()) {
+                self._thing.remove_action(name, id);
+            }
+        }
+    }
+
+    fn flush_notifications(&mut self, now: Instant) {
+        let mut values = serde_json::Map::new();
+        for (name, state) in &mut self.notify {
+            if let Some(value) = state.flush(now) {
+                values.insert(name.clone(), value);
+            }
+        }
+        self.send_property_status(values);
+    }
+
+    fn send_property_status(
+        &mut self,
+        values: serde_json::Map<String, serde_json::Value>,
+    ) {
+        if values.is_empty() || self.subscribers.cursors.is_empty() {
+            return;
+        }
+        metrics().notified(self.subscribers.cursors.len());
+        let mut message = serde_json::Map::new();
+        message.insert("messageType".to_owned(), "propertyStatus".into());
+        message.insert("data".to_owned(), serde_json::Value::Object(values));
+        self.subscribers.push(serde_json::to_string(&message).unwrap());
+    }
+
+    fn properties_notify(
+        &mut self,
+        values: serde_json::Map<String, serde_json::Value>,
+    ) {
+        self.snapshot.publish_all(&values);
+        let now = Instant::now();
+        self.flush_notifications(now);
+        let values: serde_json::Map<String, serde_json::Value> = values
+            .into_iter()
+            .filter_map(|(name, value)| {
+                let value = match self.notify.get_mut(&name) {
+                    None => Some(value),
+                    Some(state) => state.admit(value, now),
+                };
+                value.map(|value| (name, value))
+            })
+            .collect();
+        self.send_property_status(values);
+    }
+}
+impl Thing for webthing_thing {
+    fn as_thing_description(
+        &self,
+    ) -> serde_json::Map<String, serde_json::Value> {
+        self.thing_description().description.clone()
+    }
+
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn as_mut_any(&mut self) -> &mut dyn Any {
+        self
+    }
+
+    fn get_href(&self) -> String {
+        self._thing.get_href()
+    }
+
+    fn get_href_prefix(&self) -> String {
+        self._thing.get_href_prefix()
+    }
+
+    fn get_ui_href(&self) -> Option<String> {
+        self._thing.get_ui_href()
+    }
+
+    fn set_href_prefix(&mut self, prefix: String) {
+        self.invalidate_thing_description();
+        self._thing.set_href_prefix(prefix)
+    }
+
+    fn set_ui_href(&mut self, href: String) {
+        self.invalidate_thing_description();
+        self._thing.set_ui_href(href)
+    }
+
+    fn get_id(&self) -> String {
+        self._thing.get_id()
+    }
+
+    fn get_title(&self) -> String {
+        self._thing.get_title()
+    }
+
+    fn get_context(&self) -> String {
+        self._thing.get_context()
+    }
+
+    fn get_type(&self) -> Vec<String> {
+        self._thing.get_type()
+    }
+
+    fn get_description(&self) -> String {
+        self._thing.get_description()
+    }
+
+    fn get_property_descriptions(
+        &self,
+    ) -> serde_json::Map<String, serde_json::Value> {
+        self._thing.get_property_descriptions()
+    }
+
+    fn get_action_descriptions(
+        &self,
+        action_name: Option<String>,
+    ) -> serde_json::Value {
+        self._thing.get_action_descriptions(action_name)
+    }
+
+    fn get_event_descriptions(
+        &self,
+        event_name: Option<String>,
+    ) -> serde_json::Value {
+        self.events.descriptions(event_name.as_ref(), 0, 0).0
+    }
+
+    fn add_property(&mut self, property: Box<dyn Property>) {
+        self.invalidate_thing_description();
+        let name = property.get_name();
+        self.forget_property(&name);
+        self._thing.add_property(property);
+        let property = self
+            ._thing
+            .find_property(&name)
+            .map(|p| &mut **p as *mut dyn Property);
+        if let Some(property) = property {
+            property_owners().write().unwrap().insert(
+                property_key(unsafe { &*property }),
+                PropertyOwner {
+                    name: name.clone(),
+                    snapshot: Arc::downgrade(&self.snapshot),
+                    description: Arc::downgrade(&self.description),
+                },
+            );
+        }
+        if let Some(value) = self._thing.get_property(&name) {
+            self.snapshot.publish(&name, value);
+        }
+        match self.properties.iter_mut().find(|(n, _)| *n == name) {
+            None => self.properties.push((name, property)),
+            Some(entry) => entry.1 = property,
+        }
+    }
+
+    fn remove_property(&mut self, property_name: String) {
+        self.invalidate_thing_description();
+        self.forget_property(&property_name);
+        if let Some(entry) =
+            self.properties.iter_mut().find(|(n, _)| *n == property_name)
+        {
+            entry.1 = None;
+        }
+        self.snapshot.remove(&property_name);
+        self._thing.remove_property(property_name)
+    }
+
+    fn find_property(
+        &mut self,
+        property_name: &String,
+    ) -> Option<&mut Box<dyn Property>> {
+        self._thing.find_property(property_name)
+    }
+
+    fn get_property(
+        &self,
+        property_name: &String,
+    ) -> Option<serde_json::Value> {
+        Metrics::incr(&metrics().property_reads);
+        self._thing.get_property(property_name)
+    }
+
+    fn get_properties(&self) -> serde_json::Map<String, serde_json::Value> {
+        Metrics::incr(&metrics().property_reads);
+        self._thing.get_properties()
+    }
+
+    fn has_property(&self, property_name: &String) -> bool {
+        self._thing.has_property(property_name)
+    }
+
+    fn set_property(
+        &mut self,
+        property_name: String,
+        value: serde_json::Value,
+    ) -> Result<(), &'static str> {
+        // BaseThing would notify its subscribers directly, bypassing the
+        // notification policy.
+        Metrics::incr(&metrics().property_writes);
+        // Outside of the PUT handler, a server worker only sets properties
+        // for a websocket of the webthing crate, which holds the thing lock
+        // meanwhile. An asynchronous value is completed in the background
+        // there, and reported through the property notification.
+        let background = !DEFER_VALUES.with(Cell::get) && System::is_set();
+        if background {
+            DEFER_VALUES.with(|defer| defer.set(true));
+        }
+        let res = self
+            ._thing
+            .find_property(&property_name)
+            .ok_or("Property not found")
+            .and_then(|property| property.set_value(value.clone()));
+        if background {
+            DEFER_VALUES.with(|defer| defer.set(false));
+            if let Some(pending) =
+                DEFERRED_VALUE.with(|d| d.borrow_mut().take())
+            {
+                let thing = self.this.clone();
+                actix::spawn(async move {
+                    let pending =
+                        actix::clock::timeout(VALUE_TIMEOUT, pending);
+                    if let (Ok(Ok(Some(value))), Some(thing)) =
+                        (pending.await, thing.upgrade())
+                    {
+                        let _ = complete_value(&thing, &property_name, value);
+                    }
+                });
+                return Ok(());
+            }
+        }
+        res?;
+        self.property_notify(property_name, value);
+        Ok(())
+    }
+
+    fn get_action(
+        &self,
+        action_name: String,
+        action_id: String,
+    ) -> Option<Arc<RwLock<Box<dyn Action>>>> {
+        self._thing.get_action(action_name, action_id)
+    }
+
+    fn add_event(&mut self, event: Box<dyn Event>) {
+        self._thing
+            .event_notify(event.get_name(), event.as_event_description());
+        self.events.push(event);
+    }
+
+    fn add_available_event(
+        &mut self,
+        name: String,
+        metadata: serde_json::Map<String, serde_json::Value>,
+    ) {
+        self.invalidate_thing_description();
+        self._thing.add_available_event(name, metadata)
+    }
+
+    fn add_action(
+        &mut self,
+        action: Arc<RwLock<Box<dyn Action>>>,
+        input: Option<&serde_json::Value>,
+    ) -> Result<(), &str> {
+        self.evict_actions();
+        self._thing.add_action(action, input)
+    }
+
+    fn remove_action(
+        &mut self,
+        action_name: String,
+        action_id: String,
+    ) -> bool {
+        self.retention.forget(&action_name, &action_id);
+        self._thing.remove_action(action_name, action_id)
+    }
+
+    fn add_available_action(
+        &mut self,
+        name: String,
+        metadata: serde_json::Map<String, serde_json::Value>,
+    ) {
+        self.invalidate_thing_description();
+        self._thing.add_available_action(name, metadata)
+    }
+
+    fn add_subscriber(&mut self, ws_id: String) {
+        if self.subscribers.subscribe(ws_id.clone()) {
+            Metrics::incr(&metrics().subscribers);
+        }
+        self._thing.add_subscriber(ws_id)
+    }
+
+    fn remove_subscriber(&mut self, ws_id: String) {
+        if self.subscribers.unsubscribe(&ws_id) {
+            metrics().subscribers.fetch_sub(1, Ordering::Relaxed);
+        }
+        self._thing.remove_subscriber(ws_id)
+    }
+
+    fn add_event_subscriber(&mut self, name: String, ws_id: String) {
+        self._thing.add_event_subscriber(name, ws_id)
+    }
+
+    fn remove_event_subscriber(&mut self, name: String, ws_id: String) {
+        self._thing.remove_event_subscriber(name, ws_id)
+    }
+
+    fn property_notify(&mut self, name: String, value: serde_json::Value) {
+        self.snapshot.publish(&name, value.clone());
+        let now = Instant::now();
+        self.flush_notifications(now);
+        let value = match self.notify.get_mut(&name) {
+            None => Some(value),
+            Some(state) => state.admit(value, now),
+        };
+        if let Some(value) = value {
+            let mut values = serde_json::Map::new();
+            values.insert(name, value);
+            self.send_property_status(values);
+        }
+    }
+
+    fn action_notify(
+        &mut self,
+        action: serde_json::Map<String, serde_json::Value>,
+    ) {
+        self._thing.action_notify(action)
+    }
+
+    fn event_notify(
+        &mut self,
+        name: String,
+        event: serde_json::Map<String, serde_json::Value>,
+    ) {
+        self._thing.event_notify(name, event)
+    }
+
+    fn start_action(&mut self, name: String, id: String) {
+        DISPATCH_ACTIONS.with(|dispatch| dispatch.set(true));
+        self._thing.start_action(name, id);
+        DISPATCH_ACTIONS.with(|dispatch| dispatch.set(false));
+    }
+
+    fn cancel_action(&mut self, name: String, id: String) {
+        self._thing.cancel_action(name, id)
+    }
+
+    fn finish_action(&mut self, name: String, id: String) {
+        Metrics::incr(&metrics().actions_completed);
+        self._thing.finish_action(name.clone(), id.clone());
+        if self.retention.is_enabled() {
+            self.retention
+                .completed
+                .entry(name)
+                .or_default()
+                .push_back((id, Instant::now()));
+            self.evict_actions();
+        }
+    }
+
+    fn drain_queue(&mut self, ws_id: String) -> Vec<Drain<String>> {
+        // The websocket sessions poll their queues periodically, which
+        // doubles as the timer for coalesced notifications.
+        self.flush_notifications(Instant::now());
+        let mut drains = self._thing.drain_queue(ws_id.clone());
+        if let Some(drain) = self.subscribers.drain(&ws_id) {
+            drains.push(drain);
+        }
+        drains
+    }
+}
+
+#[derive(Debug)]
+#[repr(C)]
+pub struct webthing_property_value {
+    name: *const c_char,
+    value: *const c_char,
+}
+
+#[derive(Debug)]
+#[repr(C)]
+pub struct webthing_ssl_options {
+    a: *const c_char,
+    b: *const c_char,
+}
+impl webthing_ssl_options {
+    fn convert(&self) -> (String, String) {
+        (cstr_to_str!(self.a), cstr_to_str!(self.b))
+    }
+}
+
+#[repr(C)]
+pub struct webthing_thing_read_lock {
+    thing: *const Box<dyn Thing>,
+    _guard: *const libc::c_void,
+}
+
+#[repr(C)]
+pub struct webthing_thing_write_lock {
+    thing: *const Box<dyn Thing>,
+    _guard: *const libc::c_void,
+}
+
+#[repr(C)]
+pub struct webthing_action_read_lock {
+    action: *const Box<dyn Action>,
+    _guard: *const libc::c_void,
+}
+
+#[repr(C)]
+pub struct webthing_action_write_lock {
+    action: *const Box<dyn Action>,
+    _guard: *const libc::c_void,
+}
+
+// Thing functions
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_new(
+    id: *const c_char,
+    title: *const c_char,
+    capabilities: *const webthing_str_arr,
+    description: *const c_char,
+) -> *mut Box<dyn Thing> {
+    to_dbox!(
+        webthing_thing {
+            _thing: BaseThing::new(
+                cstr_to_str!(id),
+                cstr_to_str!(title),
+                to_opt!(webthing_str_arr_to_str_vec!(capabilities)),
+                to_opt!(cstr_to_str!(description)),
+            ),
+            subscribers: MessageLog::default(),
+            properties: Vec::new(),
+            snapshot: Arc::default(),
+            events: EventLog::default(),
+            retention: ActionRetention::default(),
+            notify: HashMap::new(),
+            description: Arc::default(),
+            this: Weak::new(),
+        },
+        Thing
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_id(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_id()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_id_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_id(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_title(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_title()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_title_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_title(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_description(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_description()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_description_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_description(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_as_thing_description(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        match thing.as_any().downcast_ref::<webthing_thing>() {
+            Some(t) => str_to_cstr!(&*t.thing_description().json),
+            None => json_to_cstr!(&thing.as_thing_description()),
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_href(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_href()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_href_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_href(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_href_prefix(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_href_prefix()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_href_prefix_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_href_prefix(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_ui_href(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        let a = thing.get_ui_href();
+        from_opt!(str_to_cstr!(a))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_ui_href_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| match thing.get_ui_href() {
+        None => -1,
+        Some(v) => str_to_buf!(v, buf, size),
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_context(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| str_to_cstr!(thing.get_context()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_context_buf(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| str_to_buf!(thing.get_context(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_property_descriptions(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        json_to_cstr!(&thing.get_property_descriptions())
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_action_descriptions(
+    thing: *mut Box<dyn Thing>,
+    action_name: *mut c_char,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        json_to_cstr!(
+            &thing.get_action_descriptions(to_opt!(cstr_to_str!(action_name)))
+        )
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_event_descriptions(
+    thing: *mut Box<dyn Thing>,
+    event_name: *mut c_char,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        json_to_cstr!(
+            &thing.get_event_descriptions(to_opt!(cstr_to_str!(event_name)))
+        )
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_properties(
+    thing: *mut Box<dyn Thing>,
+) -> *const c_char {
+    undbox!(|thing: Thing| json_to_cstr!(&thing.get_properties()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_properties_cbor(
+    thing: *mut Box<dyn Thing>,
+    buf: *mut u8,
+    size: usize,
+) -> c_int {
+    undbox!(|thing: Thing| {
+        let mut cbor = Vec::new();
+        json_to_cbor(
+            &serde_json::Value::Object(thing.get_properties()),
+            &mut cbor,
+        );
+        if size > 0 {
+            let len = cbor.len().min(size);
+            unsafe { ptr::copy_nonoverlapping(cbor.as_ptr(), buf, len) };
+        }
+        cbor.len() as c_int
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_property_snapshot(
+    thing: *mut Box<dyn Thing>,
+) -> *const webthing_property_snapshot {
+    undbox!(|mut thing: Thing| {
+        Arc::into_raw(Arc::clone(&as_webthing_thing!(thing).snapshot))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_snapshot_get_properties(
+    snapshot: *const webthing_property_snapshot,
+) -> *const c_char {
+    str_to_cstr!(unsafe { &*snapshot }.to_json())
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_snapshot_get_property(
+    snapshot: *const webthing_property_snapshot,
+    name: *const c_char,
+) -> *const c_char {
+    let value = unsafe { &*snapshot }.get(&cstr_to_str!(name));
+    from_opt!(json_to_cstr!(value.as_deref()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_capabilities(
+    thing: *mut Box<dyn Thing>,
+) -> *const webthing_str_arr {
+    undbox!(|thing: Thing| {
+        to_box!(str_vec_to_webthing_str_arr!(thing.get_type()))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_property(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+) -> *const c_char {
+    undbox!(|thing: Thing| {
+        json_to_cstr!(&thing.get_property(&cstr_to_str!(property_name)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_property(
+    thing: *mut Box<dyn Thing>,
+    property: *mut Box<dyn Property>,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.add_property(from_dbox!(property, Property));
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_remove_property(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.remove_property(cstr_to_str!(property_name));
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_href_prefix(
+    thing: *mut Box<dyn Thing>,
+    prefix: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.set_href_prefix(cstr_to_str!(prefix));
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_ui_href(
+    thing: *mut Box<dyn Thing>,
+    href: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.set_ui_href(cstr_to_str!(href));
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_has_property(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+) -> bool {
+    undbox!(|thing: Thing| {
+        thing.has_property(&cstr_to_str!(property_name))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(thing
+            .set_property(cstr_to_str!(property_name), cstr_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_bool(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+    value: bool,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(thing
+            .set_property(cstr_to_str!(property_name), bool_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_i64(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+    value: i64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(thing
+            .set_property(cstr_to_str!(property_name), i64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_f64(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+    value: f64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(thing
+            .set_property(cstr_to_str!(property_name), f64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_str(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(thing
+            .set_property(cstr_to_str!(property_name), str_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_find_property(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+) -> *const Box<dyn Property> {
+    undbox!(|mut thing: Thing| {
+        let property = thing.find_property(&cstr_to_str!(property_name));
+        match property {
+            None => ptr::null(),
+            Some(x) => x as *const Box<dyn Property>,
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_index(
+    thing: *mut Box<dyn Thing>,
+    property_name: *mut c_char,
+) -> c_int {
+    undbox!(|mut thing: Thing| {
+        let property_name = unsafe { CStr::from_ptr(property_name) };
+        as_webthing_thing!(thing)
+            .property_index(property_name.to_str().unwrap())
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_property_at(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        json_to_cstr!(&as_webthing_thing!(thing).get_property_at(index))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_at(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_property_at(index, cstr_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_at_bool(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: bool,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_property_at(index, bool_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_at_i64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: i64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_property_at(index, i64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_at_f64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: f64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_property_at(index, f64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_property_at_str(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_property_at(index, str_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_cached_value_at(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_cached_value_at(index, cstr_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_cached_value_at_bool(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: bool,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_cached_value_at(index, bool_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_cached_value_at_i64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: i64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_cached_value_at(index, i64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_cached_value_at_f64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: f64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_cached_value_at(index, f64_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_cached_value_at_str(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        result_to_cstr!(as_webthing_thing!(thing)
+            .set_cached_value_at(index, str_to_json!(value)))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_at(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .property_notify_at(index, cstr_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_at_bool(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: bool,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .property_notify_at(index, bool_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_at_i64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: i64,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .property_notify_at(index, i64_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_at_f64(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: f64,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .property_notify_at(index, f64_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_at_str(
+    thing: *mut Box<dyn Thing>,
+    index: c_int,
+    value: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .property_notify_at(index, str_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_action(
+    thing: *mut Box<dyn Thing>,
+    action: *mut Box<dyn Action>,
+    input: *mut c_char,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        let action = from_dbox!(action, Action);
+        let action = Arc::new(RwLock::new(action));
+        let input_tmp: serde_json::Value;
+        let input = if ptr::null() == input {
+            None
+        } else {
+            input_tmp = cstr_to_json!(input);
+            Some(&input_tmp)
+        };
+        result_to_cstr!(thing.add_action(action, input))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_remove_action(
+    thing: *mut Box<dyn Thing>,
+    action_name: *mut c_char,
+    action_id: *mut c_char,
+) -> bool {
+    undbox!(|mut thing: Thing| {
+        thing.remove_action(cstr_to_str!(action_name), cstr_to_str!(action_id))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_available_action(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    metadata: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing
+            .add_available_action(cstr_to_str!(name), cstr_to_json!(metadata));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_action(
+    thing: *mut Box<dyn Thing>,
+    action_name: *mut c_char,
+    action_id: *mut c_char,
+) -> *const RwLock<Box<dyn Action>> {
+    undbox!(|thing: Thing| {
+        let action = thing
+            .get_action(cstr_to_str!(action_name), cstr_to_str!(action_id));
+        match action {
+            None => ptr::null(),
+            Some(a) => Arc::into_raw(a),
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_notify_policy(
+    thing: *mut Box<dyn Thing>,
+    property_name: *const c_char,
+    policy: *const webthing_notify_policy,
+) {
+    undbox!(|mut thing: Thing| {
+        let thing = as_webthing_thing!(thing);
+        let name = cstr_to_str!(property_name);
+        if ptr::null() == policy {
+            if let Some(mut state) = thing.notify.remove(&name) {
+                if let Some(value) = state.pending.take() {
+                    let mut values = serde_json::Map::new();
+                    values.insert(name, value);
+                    thing.send_property_status(values);
+                }
+            }
+        } else {
+            let policy = unsafe { &*policy };
+            let state = thing.notify.entry(name).or_default();
+            state.min_interval = Duration::from_millis(policy.min_interval_ms);
+            state.deadband = policy.deadband;
+            state.deadband_relative = policy.deadband_relative;
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_notify_stats(
+    thing: *mut Box<dyn Thing>,
+    property_name: *const c_char,
+    stats: *mut webthing_notify_stats,
+) -> bool {
+    undbox!(|mut thing: Thing| {
+        match as_webthing_thing!(thing)
+            .notify
+            .get(&cstr_to_str!(property_name))
+        {
+            None => false,
+            Some(state) => {
+                let stats = unsafe { &mut *stats };
+                stats.coalesced = state.stats.coalesced;
+                stats.dropped = state.stats.dropped;
+                stats.filtered = state.stats.filtered;
+                true
+            }
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_action_retention(
+    thing: *mut Box<dyn Thing>,
+    max_completed: usize,
+    max_age_ms: u64,
+) {
+    undbox!(|mut thing: Thing| {
+        let thing = as_webthing_thing!(thing);
+        thing.retention.max_completed = max_completed;
+        thing.retention.max_age = Duration::from_millis(max_age_ms);
+        thing.evict_actions();
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_set_event_capacity(
+    thing: *mut Box<dyn Thing>,
+    event_name: *const c_char,
+    capacity: usize,
+) {
+    undbox!(|mut thing: Thing| {
+        as_webthing_thing!(thing)
+            .events
+            .set_capacity(to_opt!(cstr_to_str!(event_name)), capacity)
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_get_event_descriptions_since(
+    thing: *mut Box<dyn Thing>,
+    event_name: *const c_char,
+    since: u64,
+    limit: usize,
+    last: *mut u64,
+) -> *const c_char {
+    undbox!(|mut thing: Thing| {
+        let (descriptions, seq) =
+            as_webthing_thing!(thing).events.descriptions(
+                to_opt!(cstr_to_str!(event_name)).as_ref(),
+                since,
+                limit,
+            );
+        if ptr::null() != last {
+            unsafe { *last = seq };
+        }
+        json_to_cstr!(&descriptions)
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_event(
+    thing: *mut Box<dyn Thing>,
+    event: *mut Box<dyn Event>,
+) {
+    undbox!(|mut thing: Thing| {
+        let event = from_dbox!(event, Event);
+        thing.add_event(event)
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_available_event(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    metadata: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.add_available_event(cstr_to_str!(name), cstr_to_json!(metadata));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_add_subscriber(
+    thing: *mut Box<dyn Thing>,
+    ws_id: *const c_char,
+) {
+    undbox!(|mut thing: Thing| thing.add_subscriber(cstr_to_str!(ws_id)))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_remove_subscriber(
+    thing: *mut Box<dyn Thing>,
+    ws_id: *const c_char,
+) {
+    undbox!(|mut thing: Thing| thing.remove_subscriber(cstr_to_str!(ws_id)))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_drain_queue(
+    thing: *mut Box<dyn Thing>,
+    ws_id: *const c_char,
+) -> *const webthing_str_arr {
+    undbox!(|mut thing: Thing| {
+        let messages: Vec<String> = thing
+            .drain_queue(cstr_to_str!(ws_id))
+            .into_iter()
+            .flatten()
+            .collect();
+        to_box!(str_vec_to_webthing_str_arr!(messages))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    value: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.property_notify(cstr_to_str!(name), cstr_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_bool(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    value: bool,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.property_notify(cstr_to_str!(name), bool_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_i64(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    value: i64,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.property_notify(cstr_to_str!(name), i64_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_f64(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    value: f64,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.property_notify(cstr_to_str!(name), f64_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_property_notify_str(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    value: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.property_notify(cstr_to_str!(name), str_to_json!(value));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_action_notify(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.action_notify(cstr_to_json!(name));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_event_notify(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    event: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.event_notify(cstr_to_str!(name), cstr_to_json!(event));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_start_action(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    id: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.start_action(cstr_to_str!(name), cstr_to_str!(id));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_finish_action(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    id: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.finish_action(cstr_to_str!(name), cstr_to_str!(id));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_cancel_action(
+    thing: *mut Box<dyn Thing>,
+    name: *mut c_char,
+    id: *mut c_char,
+) {
+    undbox!(|mut thing: Thing| {
+        thing.cancel_action(cstr_to_str!(name), cstr_to_str!(id));
+    })
+}
+
+// Action functions
+
+#[no_mangle]
+pub extern "C" fn webthing_action_new(
+    id: *mut c_char,
+    name: *mut c_char,
+    input: *mut c_char,
+    thing: *mut RwLock<Box<dyn Thing>>,
+    perform_action: extern "C" fn(
+        thing: *const RwLock<Box<dyn Thing>>,
+        action_name: *const c_char,
+        action_id: *const c_char,
+    ),
+    cancel: Option<
+        extern "C" fn(
+            thing: *const RwLock<Box<dyn Thing>>,
+            action_name: *const c_char,
+            action_id: *const c_char,
+        ),
+    >,
+) -> *const Box<dyn Action> {
+    let id = if ptr::null() == id {
+        Uuid::new_v4().to_string()
+    } else {
+        cstr_to_str!(id)
+    };
+    let name = cstr_to_str!(name);
+    let thingl = unsafe { Arc::from_raw(thing) };
+    let thing = Arc::downgrade(&thingl);
+    mem::forget(thingl);
+    to_dbox!(
+        webthing_action {
+            latencies: metrics().action_latencies_or_default(&name),
+            _action: BaseAction::new(
+                id,
+                name,
+                to_opt!(cstr_to_json!(input)),
+                thing,
+            ),
+            perform_action,
+            cancel,
+            requested: Instant::now(),
+            started: Arc::default(),
+            finished: false,
+        },
+        Action
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_set_href_prefix(
+    action: *mut Box<dyn Action>,
+    prefix: *const c_char,
 ) {
-    undbox!(|mut thing: Thing| {
-        thing.add_property(from_dbox!(property, Property));
+    undbox!(|mut action: Action| {
+        action.set_href_prefix(cstr_to_str!(prefix));
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_id(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| str_to_cstr!(action.get_id()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_id_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| str_to_buf!(action.get_id(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_name(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| str_to_cstr!(action.get_name()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_name_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| str_to_buf!(action.get_name(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_href(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| str_to_cstr!(action.get_href()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_href_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| str_to_buf!(action.get_href(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_status(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| str_to_cstr!(action.get_status()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_status_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| str_to_buf!(action.get_status(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_time_requested(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| str_to_cstr!(action.get_time_requested()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_time_requested_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| str_to_buf!(
+        action.get_time_requested(),
+        buf,
+        size
+    ))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_time_completed(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| {
+        from_opt!(str_to_cstr!(action.get_time_completed()))
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_time_completed_buf(
+    action: *mut Box<dyn Action>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|action: Action| match action.get_time_completed() {
+        None => -1,
+        Some(v) => str_to_buf!(v, buf, size),
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_input(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| from_opt!(json_to_cstr!(&action.get_input())))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_get_thing(
+    action: *mut Box<dyn Action>,
+) -> *const RwLock<Box<dyn Thing>> {
+    undbox!(|action: Action| {
+        match action.get_thing() {
+            None => ptr::null(),
+            Some(t) => Arc::into_raw(t),
+        }
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_set_status(
+    action: *mut Box<dyn Action>,
+    status: *mut c_char,
+) {
+    undbox!(|mut action: Action| {
+        action.set_status(cstr_to_str!(status));
     });
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_remove_property(
-    thing: *mut Box<dyn Thing>,
-    property_name: *mut c_char,
+pub extern "C" fn webthing_action_start(action: *mut Box<dyn Action>) {
+    undbox!(|mut action: Action| {
+        action.start();
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_perform(action: *mut Box<dyn Action>) {
+    undbox!(|mut action: Action| {
+        action.perform_action();
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_finish(action: *mut Box<dyn Action>) {
+    undbox!(|mut action: Action| {
+        action.finish();
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_cancel(action: *mut Box<dyn Action>) {
+    undbox!(|mut action: Action| {
+        action.cancel();
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_pool_configure(
+    workers: usize,
+    queue_depth: usize,
 ) {
-    undbox!(|mut thing: Thing| {
-        thing.remove_property(cstr_to_str!(property_name));
+    let pool = action_pool();
+    let mut state = pool.state.lock().unwrap();
+    state.workers = workers.max(1);
+    state.queue_depth = queue_depth;
+    pool.ready.notify_all();
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_pool_set_limit(
+    action_name: *const c_char,
+    limit: usize,
+) {
+    let pool = action_pool();
+    let mut state = pool.state.lock().unwrap();
+    if limit == 0 {
+        state.limits.remove(&cstr_to_str!(action_name));
+    } else {
+        state.limits.insert(cstr_to_str!(action_name), limit);
+    }
+    pool.ready.notify_all();
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_as_action_description(
+    action: *mut Box<dyn Action>,
+) -> *const c_char {
+    undbox!(|action: Action| {
+        json_to_cstr!(&action.as_action_description())
+    })
+}
+
+// Event functions
+
+#[no_mangle]
+pub extern "C" fn webthing_event_new(
+    name: *mut c_char,
+    data: *mut c_char,
+) -> *const Box<dyn Event> {
+    to_dbox!(BaseEvent::new(cstr_to_str!(name), cstr_to_json!(data),), Event)
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_get_name(
+    event: *mut Box<dyn Event>,
+) -> *const c_char {
+    undbox!(|event: Event| str_to_cstr!(event.get_name()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_get_name_buf(
+    event: *mut Box<dyn Event>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|event: Event| str_to_buf!(event.get_name(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_get_data(
+    event: *mut Box<dyn Event>,
+) -> *const c_char {
+    undbox!(|event: Event| json_to_cstr!(&event.get_data()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_get_time(
+    event: *mut Box<dyn Event>,
+) -> *const c_char {
+    undbox!(|event: Event| str_to_cstr!(event.get_time()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_get_time_buf(
+    event: *mut Box<dyn Event>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|event: Event| str_to_buf!(event.get_time(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_event_as_event_description(
+    event: *mut Box<dyn Event>,
+) -> *const c_char {
+    undbox!(|event: Event| json_to_cstr!(&event.as_event_description()))
+}
+
+// Property functions
+
+#[no_mangle]
+pub extern "C" fn webthing_property_new(
+    name: *mut c_char,
+    initial_value: *mut c_char,
+    value_forwarder: *mut webthing_value_forwarder,
+    metadata: *mut c_char,
+) -> *const Box<dyn Property> {
+    let value_forwarder = to_opt!(value_forwarder, {
+        let value_forwarder = unsafe { Box::from_raw(value_forwarder) };
+        let res = value_forwarder.clone() as Box<dyn ValueForwarder>;
+        mem::forget(value_forwarder);
+        res
     });
+    to_dbox!(
+        BaseProperty::new(
+            cstr_to_str!(name),
+            cstr_to_json!(initial_value),
+            value_forwarder,
+            to_opt!(cstr_to_json!(metadata)),
+        ),
+        Property
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_get_name(
+    property: *mut Box<dyn Property>,
+) -> *const c_char {
+    undbox!(|property: Property| json_to_cstr!(&property.get_name()))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_get_name_buf(
+    property: *mut Box<dyn Property>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|property: Property| str_to_buf!(property.get_name(), buf, size))
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_get_metadata(
+    property: *mut Box<dyn Property>,
+) -> *const c_char {
+    undbox!(|property: Property| json_to_cstr!(&property.get_metadata()))
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_set_href_prefix(
-    thing: *mut Box<dyn Thing>,
-    prefix: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.set_href_prefix(cstr_to_str!(prefix));
-    });
+pub extern "C" fn webthing_property_get_value(
+    property: *mut Box<dyn Property>,
+) -> *const c_char {
+    undbox!(|property: Property| json_to_cstr!(&property.get_value()))
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_set_ui_href(
-    thing: *mut Box<dyn Thing>,
-    href: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.set_ui_href(cstr_to_str!(href));
-    });
+pub extern "C" fn webthing_property_get_value_bool(
+    property: *mut Box<dyn Property>,
+    value: *mut bool,
+) -> bool {
+    undbox!(|property: Property| {
+        match property.get_value().as_bool() {
+            None => false,
+            Some(v) => {
+                unsafe { *value = v };
+                true
+            }
+        }
+    })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_has_property(
-    thing: *mut Box<dyn Thing>,
-    property_name: *mut c_char,
+pub extern "C" fn webthing_property_get_value_i64(
+    property: *mut Box<dyn Property>,
+    value: *mut i64,
 ) -> bool {
-    undbox!(|thing: Thing| {
-        thing.has_property(&cstr_to_str!(property_name))
+    undbox!(|property: Property| {
+        match property.get_value().as_i64() {
+            None => false,
+            Some(v) => {
+                unsafe { *value = v };
+                true
+            }
+        }
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_set_property(
-    thing: *mut Box<dyn Thing>,
-    property_name: *mut c_char,
-    value: *mut c_char,
-) -> *const c_char {
-    undbox!(|mut thing: Thing| {
-        result_to_cstr!(thing
-            .set_property(cstr_to_str!(property_name), cstr_to_json!(value)))
+pub extern "C" fn webthing_property_get_value_f64(
+    property: *mut Box<dyn Property>,
+    value: *mut f64,
+) -> bool {
+    undbox!(|property: Property| {
+        match property.get_value().as_f64() {
+            None => false,
+            Some(v) => {
+                unsafe { *value = v };
+                true
+            }
+        }
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_find_property(
-    thing: *mut Box<dyn Thing>,
-    property_name: *mut c_char,
-) -> *const Box<dyn Property> {
-    undbox!(|mut thing: Thing| {
-        let property = thing.find_property(&cstr_to_str!(property_name));
-        match property {
-            None => ptr::null(),
-            Some(x) => to_box!(from_dbox!(x, Property)),
+pub extern "C" fn webthing_property_get_value_str(
+    property: *mut Box<dyn Property>,
+) -> *const c_char {
+    undbox!(|property: Property| {
+        match property.get_value() {
+            serde_json::Value::String(v) => str_to_cstr!(v),
+            _ => ptr::null(),
         }
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_add_action(
-    thing: *mut Box<dyn Thing>,
-    action: *mut Box<dyn Action>,
-    input: *mut c_char,
+pub extern "C" fn webthing_property_get_href(
+    property: *mut Box<dyn Property>,
 ) -> *const c_char {
-    undbox!(|mut thing: Thing| {
-        let action = from_dbox!(action, Action);
-        let action = Arc::new(RwLock::new(action));
-        let input_tmp: serde_json::Value;
-        let input = if ptr::null() == input {
-            None
-        } else {
-            input_tmp = cstr_to_json!(input);
-            Some(&input_tmp)
-        };
-        result_to_cstr!(thing.add_action(action, input))
-    })
+    undbox!(|property: Property| str_to_cstr!(property.get_href()))
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_remove_action(
-    thing: *mut Box<dyn Thing>,
-    action_name: *mut c_char,
-    action_id: *mut c_char,
-) -> bool {
-    undbox!(|mut thing: Thing| {
-        thing.remove_action(cstr_to_str!(action_name), cstr_to_str!(action_id))
-    })
+pub extern "C" fn webthing_property_get_href_buf(
+    property: *mut Box<dyn Property>,
+    buf: *mut c_char,
+    size: usize,
+) -> c_int {
+    undbox!(|property: Property| str_to_buf!(property.get_href(), buf, size))
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_add_available_action(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    metadata: *mut c_char,
+pub extern "C" fn webthing_property_set_href_prefix(
+    property: *mut Box<dyn Property>,
+    prefix: *const c_char,
 ) {
-    undbox!(|mut thing: Thing| {
-        thing
-            .add_available_action(cstr_to_str!(name), cstr_to_json!(metadata));
+    undbox!(|mut property: Property| {
+        property.set_href_prefix(cstr_to_str!(prefix));
+        let owner = property_owners()
+            .read()
+            .unwrap()
+            .get(&property_key(&**property))
+            .and_then(|owner| owner.description.upgrade());
+        if let Some(description) = owner {
+            *description.lock().unwrap() = None;
+        }
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_property_set_value(
+    property: *mut Box<dyn Property>,
+    value: *const c_char,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_value(cstr_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_get_action(
-    thing: *mut Box<dyn Thing>,
-    action_name: *mut c_char,
-    action_id: *mut c_char,
-) -> *const RwLock<Box<dyn Action>> {
-    undbox!(|thing: Thing| {
-        let action = thing
-            .get_action(cstr_to_str!(action_name), cstr_to_str!(action_id));
-        match action {
-            None => ptr::null(),
-            Some(a) => Arc::into_raw(a),
-        }
+pub extern "C" fn webthing_property_set_cached_value(
+    property: *mut Box<dyn Property>,
+    value: *const c_char,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_cached_value(cstr_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_add_event(
-    thing: *mut Box<dyn Thing>,
-    event: *mut Box<dyn Event>,
-) {
-    undbox!(|mut thing: Thing| {
-        let event = from_dbox!(event, Event);
-        thing.add_event(event)
+pub extern "C" fn webthing_property_set_cached_value_bool(
+    property: *mut Box<dyn Property>,
+    value: bool,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_cached_value(bool_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_add_available_event(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    metadata: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.add_available_event(cstr_to_str!(name), cstr_to_json!(metadata));
+pub extern "C" fn webthing_property_set_cached_value_i64(
+    property: *mut Box<dyn Property>,
+    value: i64,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_cached_value(i64_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_property_notify(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    value: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.property_notify(cstr_to_str!(name), cstr_to_json!(value));
+pub extern "C" fn webthing_property_set_cached_value_f64(
+    property: *mut Box<dyn Property>,
+    value: f64,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_cached_value(f64_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_action_notify(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.action_notify(cstr_to_json!(name));
+pub extern "C" fn webthing_property_set_cached_value_str(
+    property: *mut Box<dyn Property>,
+    value: *const c_char,
+) -> *const c_char {
+    undbox!(|mut property: Property| {
+        result_to_cstr!(publish_write(
+            property.set_cached_value(str_to_json!(value)),
+            &**property,
+        ))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_event_notify(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    event: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.event_notify(cstr_to_str!(name), cstr_to_json!(event));
+pub extern "C" fn webthing_property_as_property_description(
+    property: *mut Box<dyn Property>,
+) -> *const c_char {
+    undbox!(|property: Property| {
+        json_to_cstr!(&property.as_property_description())
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_start_action(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    id: *mut c_char,
-) {
-    undbox!(|mut thing: Thing| {
-        thing.start_action(cstr_to_str!(name), cstr_to_str!(id));
+pub extern "C" fn webthing_property_validate_value(
+    property: *mut Box<dyn Property>,
+    value: *const c_char,
+) -> *const c_char {
+    undbox!(|property: Property| {
+        result_to_cstr!(property.validate_value(&cstr_to_json!(value)))
     })
 }
 
 #[no_mangle]
-pub extern "C" fn webthing_thing_finish_action(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    id: *mut c_char,
+pub extern "C" fn webthing_value_forwarder_complete(
+    token: *mut webthing_value_token,
+    value: *const c_char,
+) {
+    let token = unsafe { Box::from_raw(token) };
+    metrics().latencies.set_value.record(token.start.elapsed());
+    let _ = token.sender.send(to_opt!(cstr_to_json!(value)));
+}
+
+// Server functions
+
+#[derive(Debug)]
+#[repr(C)]
+pub struct webthing_server_options {
+    cpu_affinity: u64,
+    snapshot_reads: bool,
+    metrics: bool,
+}
+
+// Restricts the calling thread to the CPUs in mask. Fails if the mask names
+// a CPU that is offline or not permitted.
+#[cfg(target_os = "linux")]
+fn set_cpu_affinity(mask: u64) -> bool {
+    let size = mem::size_of::<libc::cpu_set_t>();
+    unsafe {
+        let mut available: libc::cpu_set_t = mem::zeroed();
+        if libc::sched_getaffinity(0, size, &mut available) != 0 {
+            return false;
+        }
+        let mut set: libc::cpu_set_t = mem::zeroed();
+        for cpu in 0..64 {
+            if mask & (1 << cpu) != 0 {
+                if !libc::CPU_ISSET(cpu, &available) {
+                    return false;
+                }
+                libc::CPU_SET(cpu, &mut set);
+            }
+        }
+        libc::sched_setaffinity(0, size, &set) == 0
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn set_cpu_affinity(_mask: u64) -> bool {
+    false
+}
+
+struct ServerOptions {
+    cpu_affinity: u64,
+    snapshot_reads: bool,
+    metrics: bool,
+    port: Option<u16>,
+    hostname: Option<String>,
+    ssl_options: Option<(String, String)>,
+    action_generator: webthing_action_generator,
+    base_path: Option<String>,
+    disable_host_validation: bool,
+}
+impl ServerOptions {
+    fn new(
+        port: u16,
+        hostname: *const c_char,
+        ssl_options: *mut webthing_ssl_options,
+        action_generator: *mut webthing_action_generator,
+        base_path: *const c_char,
+        disable_host_validation: bool,
+        options: *const webthing_server_options,
+    ) -> Self {
+        let action_generator = unsafe { &*action_generator };
+        ServerOptions {
+            cpu_affinity: to_opt!(options, unsafe { (*options).cpu_affinity })
+                .unwrap_or(0),
+            snapshot_reads: to_opt!(options, unsafe {
+                (*options).snapshot_reads
+            })
+            .unwrap_or(false),
+            metrics: to_opt!(options, unsafe { (*options).metrics })
+                .unwrap_or(false),
+            port: if port == 0 { None } else { Some(port) },
+            hostname: to_opt!(cstr_to_str!(hostname)),
+            ssl_options: to_opt!(
+                ssl_options,
+                unsafe { &*ssl_options }.convert()
+            ),
+            action_generator: webthing_action_generator {
+                generate: action_generator.generate,
+            },
+            base_path: to_opt!(cstr_to_str!(base_path)),
+            disable_host_validation,
+        }
+    }
+
+    fn registry(&self, things: &ThingsType) -> Arc<ThingRegistry> {
+        Arc::new(ThingRegistry::new(
+            things,
+            &self.base_path,
+            self.snapshot_reads,
+        ))
+    }
+
+    fn configure(
+        &self,
+        registry: &Arc<ThingRegistry>,
+    ) -> Option<&'static ServiceConfigFn> {
+        let registry = Arc::clone(registry);
+        let base_path = registry.base_path.clone();
+        let properties_path = if registry.multiple {
+            format!("{}/{{thing_id}}/properties", base_path)
+        } else {
+            format!("{}/properties", base_path)
+        };
+        let action_generator = Arc::new(self.action_generator.clone());
+        let metrics_path = if self.metrics {
+            Some(format!("{}/metrics", base_path))
+        } else {
+            None
+        };
+        // WebThingServer::start wants a configuration living for 'static; one
+        // is leaked per started server.
+        Some(Box::leak(Box::new(
+            move |cfg: &mut actix_web::web::ServiceConfig| {
+                configure_cbor(cfg, &registry, &action_generator);
+                configure_descriptions(cfg, &registry);
+                let things = Arc::clone(&registry);
+                cfg.route(
+                    &format!("{}/{{property_name}}", properties_path),
+                    actix_web::web::put().to(
+                        move |req: actix_web::HttpRequest,
+                              body: actix_web::web::Bytes| {
+                            metrics().request(Route::PropertyWrite);
+                            let thing = things
+                                .find(&req)
+                                .map(|entry| Arc::clone(&entry.thing));
+                            let name = req
+                                .match_info()
+                                .get("property_name")
+                                .unwrap_or_default()
+                                .to_owned();
+                            let body = request_body(&req, &body);
+                            let cbor = wants_cbor(req.headers());
+                            async move {
+                                match thing {
+                                    Some(thing) => {
+                                        put_property(thing, name, body, cbor)
+                                            .await
+                                    }
+                                    None => actix_web::HttpResponse::NotFound()
+                                        .finish(),
+                                }
+                            }
+                        },
+                    ),
+                );
+                configure_actions(cfg, &registry, &action_generator);
+                configure_events(cfg, &registry);
+                configure_action_reads(cfg, &registry);
+                for path in &["", "/{property_name}"] {
+                    let registry = Arc::clone(&registry);
+                    cfg.route(
+                        &format!("{}{}", properties_path, path),
+                        actix_web::web::get().to(
+                            move |req: actix_web::HttpRequest| {
+                                metrics().request(Route::Properties);
+                                let res = match registry.find(&req) {
+                                    Some(entry) => get_properties(
+                                        &entry,
+                                        req.match_info().get("property_name"),
+                                    ),
+                                    None => {
+                                        actix_web::HttpResponse::NotFound()
+                                            .finish()
+                                    }
+                                };
+                                async move { res }
+                            },
+                        ),
+                    );
+                }
+                if let Some(path) = &metrics_path {
+                    cfg.route(
+                        path,
+                        actix_web::web::get().to(|| async {
+                            metrics().request(Route::Metrics);
+                            actix_web::HttpResponse::Ok()
+                                .content_type("text/plain; version=0.0.4")
+                                .body(metrics().render())
+                        }),
+                    );
+                }
+                if registry.multiple {
+                    configure_registered(cfg, &registry, &action_generator);
+                }
+            },
+        )))
+    }
+
+    fn into_server(self, things: ThingsType) -> WebThingServer {
+        WebThingServer::new(
+            things,
+            self.port,
+            self.hostname,
+            self.ssl_options,
+            Box::new(self.action_generator),
+            self.base_path,
+            Some(self.disable_host_validation),
+        )
+    }
+}
+
+type ServiceConfigFn =
+    dyn Fn(&mut actix_web::web::ServiceConfig) + Send + Sync + 'static;
+
+fn configure_registered(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
+    action_generator: &Arc<webthing_action_generator>,
+) {
+    let base_path = registry.base_path.clone();
+    let things = Arc::clone(registry);
+    let action_generator = Arc::clone(action_generator);
+    cfg.route(
+        &format!("{}/{{thing_id}}", base_path),
+        actix_web::web::get()
+            .guard(registered_only(registry))
+            .guard(upgrades_to_websocket())
+            .to(
+                move |req: actix_web::HttpRequest,
+                      stream: actix_web::web::Payload| {
+                    metrics().request(Route::Websocket);
+                    let res = match things.find(&req) {
+                        Some(entry) => ThingSocket::start(
+                            &entry.thing,
+                            &action_generator,
+                            &req,
+                            stream,
+                        ),
+                        None => actix_web::HttpResponse::NotFound().finish(),
+                    };
+                    async move { res }
+                },
+            ),
+    );
+    let things = Arc::clone(registry);
+    cfg.route(
+        &format!("{}/", base_path),
+        actix_web::web::get().to(move |req: actix_web::HttpRequest| {
+            metrics().request(Route::Things);
+            let res = match (
+                query_param(&req, "offset"),
+                query_param(&req, "limit"),
+            ) {
+                (Ok(offset), Ok(limit)) if limit != Some(0) => {
+                    list_things(&things, &req, offset.unwrap_or(0), limit)
+                }
+                _ => actix_web::HttpResponse::BadRequest().finish(),
+            };
+            async move { res }
+        }),
+    );
+    for path in &["{thing_id}", "{thing_id}/{tail:.*}"] {
+        let path = format!("{}/{}", base_path, path);
+        let things = Arc::clone(registry);
+        cfg.route(
+            &path,
+            actix_web::web::get().guard(registered_only(registry)).to(
+                move |req: actix_web::HttpRequest| {
+                    let res = serve_registered(&things, &req);
+                    async move { res }
+                },
+            ),
+        );
+        cfg.route(
+            &path,
+            actix_web::web::route()
+                .guard(registered_only(registry))
+                .to(|| async { actix_web::HttpResponse::NotFound().finish() }),
+        );
+    }
+}
+
+// Serves the descriptions of all things from their cache. Websockets of the
+// things passed at start are left to the webthing crate.
+fn configure_descriptions(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
+) {
+    let things = Arc::clone(registry);
+    cfg.route(
+        &registry.thing_root(),
+        actix_web::web::get()
+            .guard(actix_web::guard::Not(upgrades_to_websocket()))
+            .to(move |req: actix_web::HttpRequest| {
+                metrics().request(Route::Description);
+                let res = match things.find(&req) {
+                    Some(entry) => actix_web::HttpResponse::Ok()
+                        .content_type("application/json")
+                        .body(thing_description(
+                            &**read_thing(&entry.thing),
+                            &req,
+                        )),
+                    None => actix_web::HttpResponse::NotFound().finish(),
+                };
+                async move { res }
+            }),
+    );
+}
+
+fn configure_actions(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
+    action_generator: &Arc<webthing_action_generator>,
+) {
+    let thing_path = registry.thing_path();
+    for path in &["actions", "actions/{action_name}"] {
+        let things = Arc::clone(registry);
+        let action_generator = Arc::clone(action_generator);
+        cfg.route(
+            &format!("{}/{}", thing_path, path),
+            actix_web::web::post().to(
+                move |req: actix_web::HttpRequest,
+                      body: actix_web::web::Bytes| {
+                    metrics().request(Route::ActionRequest);
+                    let res = match things.find(&req) {
+                        Some(entry) => post_action(
+                            &entry.thing,
+                            &*action_generator,
+                            req.match_info().get("action_name"),
+                            request_body(&req, &body),
+                            wants_cbor(req.headers()),
+                        ),
+                        None => actix_web::HttpResponse::NotFound().finish(),
+                    };
+                    async move { res }
+                },
+            ),
+        );
+    }
+    let things = Arc::clone(registry);
+    cfg.route(
+        &format!("{}/actions/{{action_name}}/{{action_id}}", thing_path),
+        actix_web::web::delete().to(move |req: actix_web::HttpRequest| {
+            metrics().request(Route::ActionCancel);
+            let res = match things.find(&req) {
+                Some(entry) => delete_action(&entry.thing, &req),
+                None => actix_web::HttpResponse::NotFound().finish(),
+            };
+            async move { res }
+        }),
+    );
+}
+
+// Cancels and removes an action like the DELETE handler of the webthing
+// crate, for things added to a running server as well.
+fn delete_action(
+    thing: &RwLock<Box<dyn Thing>>,
+    req: &actix_web::HttpRequest,
+) -> actix_web::HttpResponse {
+    let param = |name| req.match_info().get(name).unwrap_or_default();
+    let removed = write_thing(thing).remove_action(
+        param("action_name").to_owned(),
+        param("action_id").to_owned(),
+    );
+    if removed {
+        actix_web::HttpResponse::NoContent().finish()
+    } else {
+        actix_web::HttpResponse::NotFound().finish()
+    }
+}
+
+fn configure_events(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
 ) {
-    undbox!(|mut thing: Thing| {
-        thing.finish_action(cstr_to_str!(name), cstr_to_str!(id));
-    })
+    for path in &["events", "events/{name}"] {
+        let things = Arc::clone(registry);
+        cfg.route(
+            &format!("{}/{}", registry.thing_path(), path),
+            actix_web::web::get().to(move |req: actix_web::HttpRequest| {
+                metrics().request(Route::Events);
+                let res = match things.find(&req) {
+                    Some(entry) => get_events(&entry, &req),
+                    None => actix_web::HttpResponse::NotFound().finish(),
+                };
+                async move { res }
+            }),
+        );
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_thing_cancel_action(
-    thing: *mut Box<dyn Thing>,
-    name: *mut c_char,
-    id: *mut c_char,
+fn configure_action_reads(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
 ) {
-    undbox!(|mut thing: Thing| {
-        thing.cancel_action(cstr_to_str!(name), cstr_to_str!(id));
+    for path in &["actions", "actions/{name}", "actions/{name}/{action_id}"] {
+        let things = Arc::clone(registry);
+        cfg.route(
+            &format!("{}/{}", registry.thing_path(), path),
+            actix_web::web::get().to(move |req: actix_web::HttpRequest| {
+                metrics().request(Route::Actions);
+                let res = match things
+                    .find(&req)
+                    .and_then(|entry| action_descriptions(&entry, &req))
+                {
+                    Some(descriptions) => {
+                        actix_web::HttpResponse::Ok().json(descriptions)
+                    }
+                    None => actix_web::HttpResponse::NotFound().finish(),
+                };
+                async move { res }
+            }),
+        );
+    }
+}
+
+// Matches requests for a thing that the routes of the webthing crate must
+// not answer, see ThingRegistry::is_registered_only.
+fn registered_only(
+    registry: &Arc<ThingRegistry>,
+) -> impl actix_web::guard::Guard {
+    let registry = Arc::clone(registry);
+    let prefix = format!("{}/", registry.base_path);
+    actix_web::guard::fn_guard(move |head| {
+        let thing_id = head
+            .uri
+            .path()
+            .strip_prefix(&prefix)
+            .and_then(|path| path.split('/').next())
+            .unwrap_or_default();
+        registry.is_registered_only(thing_id)
     })
 }
 
-// Action functions
+// The things served by one server. Entries are kept at the index used in
+// the URLs of the webthing crate and are hashed by thing id, so that routes
+// are registered once per server instead of once per thing and a lookup
+// does not depend on the number of things.
+//
+// Things can be added and removed while the server runs. The webthing crate
+// only knows about the things passed at start, so requests for any other
+// index or id, or for a removed thing, are answered from the registry (see
+// serve_registered). Indices are never reused.
+struct ThingRegistry {
+    base_path: String,
+    multiple: bool,
+    snapshot_reads: bool,
+    started: usize,
+    // Only held to look up or swap an entry, never during a request.
+    state: RwLock<RegistryState>,
+}
 
-#[no_mangle]
-pub extern "C" fn webthing_action_new(
-    id: *mut c_char,
-    name: *mut c_char,
-    input: *mut c_char,
-    thing: *mut RwLock<Box<dyn Thing>>,
-    perform_action: extern "C" fn(
-        thing: *const RwLock<Box<dyn Thing>>,
-        action_name: *const c_char,
-        action_id: *const c_char,
-    ),
-    cancel: Option<
-        extern "C" fn(
-            thing: *const RwLock<Box<dyn Thing>>,
-            action_name: *const c_char,
-            action_id: *const c_char,
-        ),
-    >,
-) -> *const Box<dyn Action> {
-    let id = if ptr::null() == id {
-        Uuid::new_v4().to_string()
-    } else {
-        cstr_to_str!(id)
-    };
-    let thingl = unsafe { Arc::from_raw(thing) };
-    let thing = Arc::downgrade(&thingl);
-    mem::forget(thingl);
-    to_dbox!(
-        webthing_action {
-            _action: BaseAction::new(
-                id,
-                cstr_to_str!(name),
-                to_opt!(cstr_to_json!(input)),
-                thing,
-            ),
-            perform_action,
-            cancel,
-        },
-        Action
-    )
+#[derive(Default)]
+struct RegistryState {
+    things: Vec<Option<Arc<RegisteredThing>>>,
+    ids: HashMap<String, usize>,
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_set_href_prefix(
-    action: *mut Box<dyn Action>,
-    prefix: *const c_char,
-) {
-    undbox!(|mut action: Action| {
-        action.set_href_prefix(cstr_to_str!(prefix));
-    })
+struct RegisteredThing {
+    thing: Arc<RwLock<Box<dyn Thing>>>,
+    snapshot: Option<Arc<webthing_property_snapshot>>,
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_id(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| str_to_cstr!(action.get_id()))
+impl RegisteredThing {
+    fn new(
+        thing: Arc<RwLock<Box<dyn Thing>>>,
+        snapshot_reads: bool,
+    ) -> (String, Arc<Self>) {
+        let (id, snapshot) = {
+            let guard = read_thing(&thing);
+            let snapshot = guard
+                .as_any()
+                .downcast_ref::<webthing_thing>()
+                .filter(|_| snapshot_reads)
+                .map(|t| Arc::clone(&t.snapshot));
+            (guard.get_id(), snapshot)
+        };
+        (id, Arc::new(RegisteredThing { thing, snapshot }))
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_name(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| str_to_cstr!(action.get_name()))
+impl ThingRegistry {
+    fn new(
+        things: &ThingsType,
+        base_path: &Option<String>,
+        snapshot_reads: bool,
+    ) -> Self {
+        let (things, multiple) = match things {
+            ThingsType::Single(thing) => (std::slice::from_ref(thing), false),
+            ThingsType::Multiple(things, _) => (&things[..], true),
+        };
+        let mut state = RegistryState {
+            things: Vec::with_capacity(things.len()),
+            ids: HashMap::with_capacity(things.len()),
+        };
+        for (i, thing) in things.iter().enumerate() {
+            let (id, entry) =
+                RegisteredThing::new(Arc::clone(thing), snapshot_reads);
+            state.ids.insert(id, i);
+            state.things.push(Some(entry));
+        }
+        ThingRegistry {
+            base_path: base_path
+                .as_deref()
+                .unwrap_or_default()
+                .trim_end_matches('/')
+                .to_owned(),
+            multiple,
+            snapshot_reads,
+            started: things.len(),
+            state: RwLock::new(state),
+        }
+    }
+
+    // Resolves a {thing_id}, which is either the index of the thing or its
+    // id. Routes of a single thing have no {thing_id}.
+    fn get(&self, thing_id: Option<&str>) -> Option<Arc<RegisteredThing>> {
+        let state = self.state.read().unwrap();
+        let index = match thing_id {
+            None => Some(0),
+            Some(thing_id) => thing_id
+                .parse::<usize>()
+                .ok()
+                .or_else(|| state.ids.get(thing_id).copied()),
+        };
+        index.and_then(|i| state.things.get(i)).and_then(Clone::clone)
+    }
+
+    // The path of a thing as matched by the routes of a server.
+    // The path of the thing descriptions and websockets.
+    fn thing_root(&self) -> String {
+        if self.multiple {
+            self.thing_path()
+        } else {
+            format!("{}/", self.base_path)
+        }
+    }
+
+    fn thing_path(&self) -> String {
+        if self.multiple {
+            format!("{}/{{thing_id}}", self.base_path)
+        } else {
+            self.base_path.clone()
+        }
+    }
+
+    fn find(
+        &self,
+        req: &actix_web::HttpRequest,
+    ) -> Option<Arc<RegisteredThing>> {
+        self.get(req.match_info().get("thing_id"))
+    }
+
+    // Up to limit things, skipping the first offset ones, and whether
+    // there are more.
+    fn page(
+        &self,
+        offset: usize,
+        limit: usize,
+    ) -> (Vec<Arc<RegisteredThing>>, bool) {
+        let state = self.state.read().unwrap();
+        let mut things = state.things.iter().flatten().skip(offset);
+        let page = things.by_ref().take(limit).cloned().collect();
+        (page, things.next().is_some())
+    }
+
+    // Whether requests for {thing_id} bypass the routes of the webthing
+    // crate, i.e. the thing was not passed at start or has been removed.
+    fn is_registered_only(&self, thing_id: &str) -> bool {
+        match thing_id.parse::<usize>() {
+            Ok(i) if i < self.started => self
+                .state
+                .read()
+                .unwrap()
+                .things
+                .get(i)
+                .map_or(true, Option::is_none),
+            _ => true,
+        }
+    }
+
+    fn add(&self, thing: Arc<RwLock<Box<dyn Thing>>>) -> Option<usize> {
+        if !self.multiple {
+            return None;
+        }
+        let (id, entry) = RegisteredThing::new(thing, self.snapshot_reads);
+        // The index is reserved first, so that the href prefix is set
+        // without blocking lookups while waiting for the thing lock.
+        let index = {
+            let mut state = self.state.write().unwrap();
+            if state.ids.contains_key(&id) {
+                return None;
+            }
+            let index = state.things.len();
+            state.ids.insert(id, index);
+            state.things.push(None);
+            index
+        };
+        write_thing(&entry.thing)
+            .set_href_prefix(format!("{}/{}", self.base_path, index));
+        self.state.write().unwrap().things[index] = Some(entry);
+        Some(index)
+    }
+
+    fn remove(&self, id: &str) -> bool {
+        let entry = {
+            let mut state = self.state.write().unwrap();
+            match state.ids.remove(id) {
+                Some(index) => state.things[index].take(),
+                None => None,
+            }
+        };
+        entry.is_some()
+    }
+
+    // The leaked route configuration outlives the server, the things must
+    // not.
+    fn clear(&self) {
+        let mut state = self.state.write().unwrap();
+        *state = RegistryState::default();
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_href(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| str_to_cstr!(action.get_href()))
+// Answers GET /{thing_id}[/...] for things only the registry knows about.
+// Their websockets are served by ThingSocket, see configure_registered.
+fn serve_registered(
+    registry: &ThingRegistry,
+    req: &actix_web::HttpRequest,
+) -> actix_web::HttpResponse {
+    let entry = match registry.find(req) {
+        Some(entry) => entry,
+        None => return actix_web::HttpResponse::NotFound().finish(),
+    };
+    let tail = req.match_info().get("tail").unwrap_or_default();
+    let mut segments = tail.splitn(2, '/');
+    match (segments.next().unwrap_or_default(), segments.next()) {
+        ("", None) => {
+            metrics().request(Route::Description);
+            actix_web::HttpResponse::Ok()
+                .content_type("application/json")
+                .body(thing_description(&**read_thing(&entry.thing), req))
+        }
+        ("properties", name) => {
+            metrics().request(Route::Properties);
+            get_properties(&entry, name)
+        }
+        _ => actix_web::HttpResponse::NotFound().finish(),
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_status(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| str_to_cstr!(action.get_status()))
+// The thing description as served by the webthing crate, serialized. For
+// things of this library it is rendered once per scheme and host until the
+// description changes.
+fn thing_description(
+    thing: &dyn Thing,
+    req: &actix_web::HttpRequest,
+) -> actix_web::web::Bytes {
+    let info = req.connection_info();
+    match thing.as_any().downcast_ref::<webthing_thing>() {
+        Some(thing) => thing.thing_description().served(
+            info.scheme(),
+            info.host(),
+            &thing.get_href(),
+        ),
+        None => actix_web::web::Bytes::from(
+            serde_json::to_string(&serve_description(
+                thing.as_thing_description(),
+                info.scheme(),
+                info.host(),
+                &thing.get_href(),
+            ))
+            .unwrap(),
+        ),
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_time_requested(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| str_to_cstr!(action.get_time_requested()))
+// Adds the websocket link and the security scheme to a thing description,
+// like the webthing crate does.
+fn serve_description(
+    mut description: serde_json::Map<String, serde_json::Value>,
+    scheme: &str,
+    host: &str,
+    href: &str,
+) -> serde_json::Map<String, serde_json::Value> {
+    let ws_scheme = if scheme == "https" { "wss" } else { "ws" };
+    let ws_href = format!("{}://{}{}", ws_scheme, host, href);
+    if let Some(serde_json::Value::Array(links)) = description.get_mut("links")
+    {
+        links.push(serde_json::json!({"rel": "alternate", "href": ws_href}));
+    }
+    description.insert(
+        "base".to_owned(),
+        serde_json::json!(format!("{}://{}{}", scheme, host, href)),
+    );
+    description.insert(
+        "securityDefinitions".to_owned(),
+        serde_json::json!({"nosec_sc": {"scheme": "nosec"}}),
+    );
+    description.insert("security".to_owned(), serde_json::json!("nosec_sc"));
+    description
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_time_completed(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| {
-        from_opt!(str_to_cstr!(action.get_time_completed()))
+// Answers GET {thing}/events[/{name}]. The since and limit query parameters
+// page through the retained events like
+// webthing_thing_get_event_descriptions_since, the X-Last-Event header holds
+// the sequence number to pass as since on the next request.
+fn get_events(
+    entry: &RegisteredThing,
+    req: &actix_web::HttpRequest,
+) -> actix_web::HttpResponse {
+    match event_descriptions(entry, req) {
+        Some((descriptions, last)) => actix_web::HttpResponse::Ok()
+            .header("X-Last-Event", last.to_string())
+            .json(descriptions),
+        None => actix_web::HttpResponse::BadRequest().finish(),
+    }
+}
+
+fn event_descriptions(
+    entry: &RegisteredThing,
+    req: &actix_web::HttpRequest,
+) -> Option<(serde_json::Value, u64)> {
+    let since = query_param(req, "since").ok()?.unwrap_or(0);
+    let limit = query_param(req, "limit").ok()?.unwrap_or(0);
+    let name = req.match_info().get("name").map(str::to_owned);
+    let thing = read_thing(&entry.thing);
+    Some(match thing.as_any().downcast_ref::<webthing_thing>() {
+        Some(thing) => thing.events.descriptions(name.as_ref(), since, limit),
+        None => (thing.get_event_descriptions(name), 0),
     })
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_input(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| from_opt!(json_to_cstr!(&action.get_input())))
+// Describes the actions of GET {thing}/actions[/{name}[/{action_id}]], after
+// evicting the completed actions that are no longer retained. The write
+// lock is only taken if there is something to evict.
+fn action_descriptions(
+    entry: &RegisteredThing,
+    req: &actix_web::HttpRequest,
+) -> Option<serde_json::Value> {
+    let expired = read_thing(&entry.thing)
+        .as_any()
+        .downcast_ref::<webthing_thing>()
+        .map_or(false, |thing| thing.retention.has_expired(Instant::now()));
+    if expired {
+        let mut thing = write_thing(&entry.thing);
+        if let Some(thing) =
+            thing.as_mut_any().downcast_mut::<webthing_thing>()
+        {
+            thing.evict_actions();
+        }
+    }
+    let name = req.match_info().get("name").map(str::to_owned);
+    let thing = read_thing(&entry.thing);
+    match req.match_info().get("action_id") {
+        None => Some(thing.get_action_descriptions(name)),
+        Some(id) => thing
+            .get_action(name.unwrap_or_default(), id.to_owned())
+            .map(|action| {
+                serde_json::Value::Object(
+                    action.read().unwrap().as_action_description(),
+                )
+            }),
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_get_thing(
-    action: *mut Box<dyn Action>,
-) -> *const RwLock<Box<dyn Thing>> {
-    undbox!(|action: Action| {
-        match action.get_thing() {
-            None => ptr::null(),
-            Some(t) => Arc::into_raw(t),
+// Answers GET {thing}/properties[/{name}], from the property snapshot if
+// snapshot reads are enabled.
+fn get_properties(
+    entry: &RegisteredThing,
+    name: Option<&str>,
+) -> actix_web::HttpResponse {
+    match (&entry.snapshot, name) {
+        (Some(snapshot), None) => {
+            Metrics::incr(&metrics().property_reads);
+            actix_web::HttpResponse::Ok()
+                .content_type("application/json")
+                .body(snapshot.to_json())
         }
-    })
+        (Some(snapshot), Some(name)) => match snapshot.get(name) {
+            Some(value) => {
+                Metrics::incr(&metrics().property_reads);
+                actix_web::HttpResponse::Ok()
+                    .json(serde_json::json!({ name: *value }))
+            }
+            None => actix_web::HttpResponse::NotFound().finish(),
+        },
+        (None, None) => actix_web::HttpResponse::Ok()
+            .json(read_thing(&entry.thing).get_properties()),
+        (None, Some(name)) => {
+            let thing = read_thing(&entry.thing);
+            match thing.get_property(&name.to_owned()) {
+                Some(_) => property_response(&**thing, name.to_owned(), false),
+                None => actix_web::HttpResponse::NotFound().finish(),
+            }
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_set_status(
-    action: *mut Box<dyn Action>,
-    status: *mut c_char,
-) {
-    undbox!(|mut action: Action| {
-        action.set_status(cstr_to_str!(status));
-    });
+// Answers GET {base}/ with the descriptions of all things, or of the page
+// selected by the offset and limit query parameters. A Link header points
+// to the next page, if any.
+fn list_things(
+    registry: &ThingRegistry,
+    req: &actix_web::HttpRequest,
+    offset: usize,
+    limit: Option<usize>,
+) -> actix_web::HttpResponse {
+    let (things, more) = registry.page(offset, limit.unwrap_or(usize::MAX));
+    let mut body = vec![b'['];
+    for (i, entry) in things.iter().enumerate() {
+        if i > 0 {
+            body.push(b',');
+        }
+        body.extend_from_slice(&thing_description(
+            &**read_thing(&entry.thing),
+            req,
+        ));
+    }
+    body.push(b']');
+    let mut res = actix_web::HttpResponse::Ok();
+    if let (true, Some(limit)) = (more, limit) {
+        res.header(
+            "Link",
+            format!(
+                "<{}/?offset={}&limit={}>; rel=\"next\"",
+                registry.base_path,
+                offset + limit,
+                limit
+            ),
+        );
+    }
+    res.content_type("application/json").body(body)
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_start(action: *mut Box<dyn Action>) {
-    undbox!(|mut action: Action| {
-        action.start();
-    })
+fn query_param<T: std::str::FromStr>(
+    req: &actix_web::HttpRequest,
+    name: &str,
+) -> Result<Option<T>, T::Err> {
+    for param in req.query_string().split('&') {
+        let mut param = param.splitn(2, '=');
+        if let (Some(key), Some(value)) = (param.next(), param.next()) {
+            if key == name {
+                return value.parse().map(Some);
+            }
+        }
+    }
+    Ok(None)
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_perform(action: *mut Box<dyn Action>) {
-    undbox!(|mut action: Action| {
-        action.perform_action();
-    })
+// Answers GET requests accepting application/cbor on the property, action
+// and event endpoints with the same values the JSON handlers return.
+fn get_cbor(
+    registry: &ThingRegistry,
+    req: &actix_web::HttpRequest,
+) -> actix_web::HttpResponse {
+    let entry = match registry.find(req) {
+        Some(entry) => entry,
+        None => return actix_web::HttpResponse::NotFound().finish(),
+    };
+    let param = |name| req.match_info().get(name).map(str::to_owned);
+    let value = match (param("endpoint").as_deref(), param("name")) {
+        (Some("properties"), None) => match &entry.snapshot {
+            Some(snapshot) => {
+                Metrics::incr(&metrics().property_reads);
+                serde_json::Value::Object(snapshot.load())
+            }
+            None => serde_json::Value::Object(
+                read_thing(&entry.thing).get_properties(),
+            ),
+        },
+        (Some("properties"), Some(name)) => {
+            let thing = read_thing(&entry.thing);
+            match thing.get_property(&name) {
+                Some(value) => serde_json::json!({ name: value }),
+                None => return actix_web::HttpResponse::NotFound().finish(),
+            }
+        }
+        (Some("actions"), _) => match action_descriptions(&entry, req) {
+            Some(descriptions) => descriptions,
+            None => return actix_web::HttpResponse::NotFound().finish(),
+        },
+        (Some("events"), _) => match event_descriptions(&entry, req) {
+            Some((descriptions, _)) => descriptions,
+            None => return actix_web::HttpResponse::BadRequest().finish(),
+        },
+        _ => return actix_web::HttpResponse::NotFound().finish(),
+    };
+    respond(actix_web::HttpResponse::Ok(), &value, true)
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_finish(action: *mut Box<dyn Action>) {
-    undbox!(|mut action: Action| {
-        action.finish();
-    })
+fn configure_cbor(
+    cfg: &mut actix_web::web::ServiceConfig,
+    registry: &Arc<ThingRegistry>,
+    action_generator: &Arc<webthing_action_generator>,
+) {
+    let thing_path = registry.thing_path();
+    let things = Arc::clone(registry);
+    let action_generator = Arc::clone(action_generator);
+    cfg.route(
+        &registry.thing_root(),
+        actix_web::web::get()
+            .guard(accepts_cbor())
+            .guard(upgrades_to_websocket())
+            .to(
+                move |req: actix_web::HttpRequest,
+                      stream: actix_web::web::Payload| {
+                    metrics().request(Route::Websocket);
+                    let res = match things.find(&req) {
+                        Some(entry) => ThingSocket::start(
+                            &entry.thing,
+                            &action_generator,
+                            &req,
+                            stream,
+                        ),
+                        None => actix_web::HttpResponse::NotFound().finish(),
+                    };
+                    async move { res }
+                },
+            ),
+    );
+    for path in &[
+        "{endpoint:properties|actions|events}",
+        "{endpoint:properties|actions|events}/{name}",
+        "{endpoint:actions}/{name}/{action_id}",
+    ] {
+        let things = Arc::clone(registry);
+        cfg.route(
+            &format!("{}/{}", thing_path, path),
+            actix_web::web::get().guard(accepts_cbor()).to(
+                move |req: actix_web::HttpRequest| {
+                    metrics().request(Route::Cbor);
+                    let res = get_cbor(&things, &req);
+                    async move { res }
+                },
+            ),
+        );
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_cancel(action: *mut Box<dyn Action>) {
-    undbox!(|mut action: Action| {
-        action.cancel();
-    })
+fn accepts_cbor() -> impl actix_web::guard::Guard {
+    actix_web::guard::fn_guard(|head| wants_cbor(&head.headers))
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_action_as_action_description(
-    action: *mut Box<dyn Action>,
-) -> *const c_char {
-    undbox!(|action: Action| {
-        json_to_cstr!(&action.as_action_description())
+fn upgrades_to_websocket() -> impl actix_web::guard::Guard {
+    actix_web::guard::fn_guard(|head| {
+        head.headers
+            .get("upgrade")
+            .and_then(|upgrade| upgrade.to_str().ok())
+            .map_or(false, |upgrade| upgrade.eq_ignore_ascii_case("websocket"))
     })
 }
 
-// Event functions
+// Whether the Accept header lists application/cbor with a nonzero quality,
+// no lower than that of application/json.
+fn wants_cbor(headers: &actix_web::http::HeaderMap) -> bool {
+    let accept = match headers.get("accept").and_then(|a| a.to_str().ok()) {
+        Some(accept) => accept,
+        None => return false,
+    };
+    let quality = |media_type: &str| {
+        accept.split(',').find_map(|range| {
+            let mut params = range.split(';').map(str::trim);
+            if !params.next()?.eq_ignore_ascii_case(media_type) {
+                return None;
+            }
+            Some(
+                params
+                    .find_map(|param| param.strip_prefix("q="))
+                    .map_or(1.0, |q| q.parse().unwrap_or(0.0)),
+            )
+        })
+    };
+    match quality("application/cbor") {
+        Some(cbor) => {
+            cbor > 0.0 && cbor >= quality("application/json").unwrap_or(0.0)
+        }
+        None => false,
+    }
+}
 
-#[no_mangle]
-pub extern "C" fn webthing_event_new(
-    name: *mut c_char,
-    data: *mut c_char,
-) -> *const Box<dyn Event> {
-    to_dbox!(BaseEvent::new(cstr_to_str!(name), cstr_to_json!(data),), Event)
+// Decodes a request body sent as CBOR or as JSON, by its Content-Type.
+fn request_body(
+    req: &actix_web::HttpRequest,
+    body: &[u8],
+) -> Option<serde_json::Value> {
+    let cbor = req
+        .headers()
+        .get("content-type")
+        .and_then(|content_type| content_type.to_str().ok())
+        .and_then(|content_type| content_type.split(';').next())
+        .map_or(false, |media_type| {
+            media_type.trim().eq_ignore_ascii_case("application/cbor")
+        });
+    if cbor {
+        cbor_to_json(body)
+    } else {
+        serde_json::from_slice(body).ok()
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_event_get_name(
-    event: *mut Box<dyn Event>,
-) -> *const c_char {
-    undbox!(|event: Event| str_to_cstr!(event.get_name()))
+// Sends a response body as CBOR to requests accepting it, as JSON otherwise.
+fn respond(
+    mut res: actix_web::dev::HttpResponseBuilder,
+    value: &serde_json::Value,
+    cbor: bool,
+) -> actix_web::HttpResponse {
+    if !cbor {
+        return res.json(value);
+    }
+    let mut body = Vec::new();
+    json_to_cbor(value, &mut body);
+    res.content_type("application/cbor").body(body)
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_event_get_data(
-    event: *mut Box<dyn Event>,
-) -> *const c_char {
-    undbox!(|event: Event| json_to_cstr!(&event.get_data()))
+fn property_response(
+    thing: &dyn Thing,
+    name: String,
+    cbor: bool,
+) -> actix_web::HttpResponse {
+    let value = thing.get_property(&name).unwrap_or_default();
+    respond(
+        actix_web::HttpResponse::Ok(),
+        &serde_json::json!({ name: value }),
+        cbor,
+    )
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_event_get_time(
-    event: *mut Box<dyn Event>,
-) -> *const c_char {
-    undbox!(|event: Event| str_to_cstr!(event.get_time()))
+// Same as the POST handlers for actions of the webthing crate, except that
+// a request finding the action pool full is answered with 503 and a
+// Retry-After header rather than 400 or a rejected action.
+fn post_action(
+    thing: &Arc<RwLock<Box<dyn Thing>>>,
+    action_generator: &dyn ActionGenerator,
+    action_name: Option<&str>,
+    body: Option<serde_json::Value>,
+    cbor: bool,
+) -> actix_web::HttpResponse {
+    let (name, input) = match body {
+        Some(serde_json::Value::Object(args)) if args.len() == 1 => {
+            args.into_iter().next().unwrap()
+        }
+        _ => return actix_web::HttpResponse::BadRequest().finish(),
+    };
+    if action_name.map_or(false, |action_name| action_name != name) {
+        return actix_web::HttpResponse::BadRequest().finish();
+    }
+    let input = input.get("input").cloned();
+    match request_action(thing, action_generator, name.clone(), input) {
+        Ok(description) => respond(
+            actix_web::HttpResponse::Created(),
+            &serde_json::json!({ name: description }),
+            cbor,
+        ),
+        Err(ActionRefused::PoolFull) => pool_full(),
+        Err(ActionRefused::Invalid) => {
+            actix_web::HttpResponse::BadRequest().finish()
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_event_as_event_description(
-    event: *mut Box<dyn Event>,
-) -> *const c_char {
-    undbox!(|event: Event| json_to_cstr!(&event.as_event_description()))
+enum ActionRefused {
+    Invalid,
+    PoolFull,
 }
 
-// Property functions
+// Generates, adds and starts an action, returning its description.
+fn request_action(
+    thing: &Arc<RwLock<Box<dyn Thing>>>,
+    action_generator: &dyn ActionGenerator,
+    name: String,
+    input: Option<serde_json::Value>,
+) -> Result<serde_json::Map<String, serde_json::Value>, ActionRefused> {
+    let action = match action_generator.generate(
+        Arc::downgrade(thing),
+        name.clone(),
+        input.as_ref(),
+    ) {
+        Some(action) => Arc::new(RwLock::new(action)),
+        None if action_pool().is_full() => {
+            return Err(ActionRefused::PoolFull)
+        }
+        None => return Err(ActionRefused::Invalid),
+    };
+    let mut thing = write_thing(thing);
+    if thing.add_action(Arc::clone(&action), input.as_ref()).is_err() {
+        return Err(ActionRefused::Invalid);
+    }
+    let id = action.read().unwrap().get_id();
+    thing.start_action(name.clone(), id.clone());
+    // The pool may have filled up since the action was generated.
+    if action.read().unwrap().get_status() == "rejected" {
+        thing.remove_action(name, id);
+        return Err(ActionRefused::PoolFull);
+    }
+    let description = action.read().unwrap().as_action_description();
+    Ok(description)
+}
 
-#[no_mangle]
-pub extern "C" fn webthing_property_new(
-    name: *mut c_char,
-    initial_value: *mut c_char,
-    value_forwarder: *mut webthing_value_forwarder,
-    metadata: *mut c_char,
-) -> *const Box<dyn Property> {
-    let value_forwarder = to_opt!(value_forwarder, {
-        let value_forwarder = unsafe { Box::from_raw(value_forwarder) };
-        let res = value_forwarder.clone() as Box<dyn ValueForwarder>;
-        mem::forget(value_forwarder);
-        res
-    });
-    to_dbox!(
-        BaseProperty::new(
-            cstr_to_str!(name),
-            cstr_to_json!(initial_value),
-            value_forwarder,
-            to_opt!(cstr_to_json!(metadata)),
-        ),
-        Property
-    )
+fn pool_full() -> actix_web::HttpResponse {
+    actix_web::HttpResponse::ServiceUnavailable()
+        .header("Retry-After", "1")
+        .finish()
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_get_name(
-    property: *mut Box<dyn Property>,
-) -> *const c_char {
-    undbox!(|property: Property| json_to_cstr!(&property.get_name()))
+// Same as the PUT handler of the webthing crate, except that the worker is
+// not blocked while an asynchronous value forwarder is busy: the thing lock
+// is released and the response is sent once the forwarder completed, or
+// with 504 once VALUE_TIMEOUT passed.
+async fn put_property(
+    thing: Arc<RwLock<Box<dyn Thing>>>,
+    name: String,
+    body: Option<serde_json::Value>,
+    cbor: bool,
+) -> actix_web::HttpResponse {
+    let value = match body {
+        Some(serde_json::Value::Object(mut args)) => args.remove(&name),
+        _ => None,
+    };
+    let pending = {
+        let mut thing = write_thing(&thing);
+        if !thing.has_property(&name) {
+            return actix_web::HttpResponse::NotFound().finish();
+        }
+        let value = match value {
+            Some(value) => value,
+            None => return actix_web::HttpResponse::BadRequest().finish(),
+        };
+        DEFER_VALUES.with(|defer| defer.set(true));
+        let res = thing.set_property(name.clone(), value);
+        DEFER_VALUES.with(|defer| defer.set(false));
+        match (res, DEFERRED_VALUE.with(|d| d.borrow_mut().take())) {
+            (_, Some(pending)) => pending,
+            (Ok(()), None) => return property_response(&**thing, name, cbor),
+            (Err(_), None) => {
+                return actix_web::HttpResponse::Forbidden().finish()
+            }
+        }
+    };
+    let value = match actix::clock::timeout(VALUE_TIMEOUT, pending).await {
+        Ok(Ok(Some(value))) => value,
+        Ok(_) => return actix_web::HttpResponse::Forbidden().finish(),
+        Err(_) => return actix_web::HttpResponse::GatewayTimeout().finish(),
+    };
+    match complete_value(&thing, &name, value) {
+        Ok(()) => property_response(&**read_thing(&thing), name, cbor),
+        Err(_) => actix_web::HttpResponse::Forbidden().finish(),
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_get_metadata(
-    property: *mut Box<dyn Property>,
-) -> *const c_char {
-    undbox!(|property: Property| json_to_cstr!(&property.get_metadata()))
+// Stores and notifies a value completed by an asynchronous value forwarder.
+fn complete_value(
+    thing: &RwLock<Box<dyn Thing>>,
+    name: &str,
+    value: serde_json::Value,
+) -> Result<(), &'static str> {
+    let mut thing = write_thing(thing);
+    thing
+        .find_property(&name.to_owned())
+        .ok_or("Property not found")?
+        .set_cached_value(value.clone())?;
+    thing.property_notify(name.to_owned(), value);
+    Ok(())
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_get_value(
-    property: *mut Box<dyn Property>,
-) -> *const c_char {
-    undbox!(|property: Property| json_to_cstr!(&property.get_value()))
+// How often a websocket session drains its notification queue.
+const SOCKET_INTERVAL: Duration = Duration::from_millis(100);
+
+// A websocket session speaking the protocol of the sessions of the webthing
+// crate, for clients accepting application/cbor and for things added to a
+// running server, which the webthing crate does not know about. Messages
+// are sent as binary CBOR frames to clients accepting application/cbor, as
+// JSON text frames otherwise. Clients may send either.
+struct ThingSocket {
+    id: String,
+    thing: Arc<RwLock<Box<dyn Thing>>>,
+    action_generator: Arc<webthing_action_generator>,
+    cbor: bool,
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_get_href(
-    property: *mut Box<dyn Property>,
-) -> *const c_char {
-    undbox!(|property: Property| str_to_cstr!(property.get_href()))
+impl ThingSocket {
+    fn start(
+        thing: &Arc<RwLock<Box<dyn Thing>>>,
+        action_generator: &Arc<webthing_action_generator>,
+        req: &actix_web::HttpRequest,
+        stream: actix_web::web::Payload,
+    ) -> actix_web::HttpResponse {
+        let socket = ThingSocket {
+            id: Uuid::new_v4().to_string(),
+            thing: Arc::clone(thing),
+            action_generator: Arc::clone(action_generator),
+            cbor: wants_cbor(req.headers()),
+        };
+        match actix_web_actors::ws::start(socket, req, stream) {
+            Ok(res) => res,
+            Err(_) => actix_web::HttpResponse::BadRequest().finish(),
+        }
+    }
+
+    fn send(
+        &self,
+        ctx: &mut <Self as Actor>::Context,
+        message: &serde_json::Value,
+    ) {
+        if !self.cbor {
+            return ctx.text(message.to_string());
+        }
+        let mut body = Vec::new();
+        json_to_cbor(message, &mut body);
+        ctx.binary(body);
+    }
+
+    fn send_error(
+        &self,
+        ctx: &mut <Self as Actor>::Context,
+        status: &str,
+        message: &str,
+    ) {
+        self.send(
+            ctx,
+            &serde_json::json!({
+                "messageType": "error",
+                "data": { "status": status, "message": message },
+            }),
+        );
+    }
+
+    fn dispatch(
+        &self,
+        ctx: &mut <Self as Actor>::Context,
+        message: serde_json::Value,
+    ) {
+        let (message_type, data) = match (
+            message.get("messageType").and_then(|t| t.as_str()),
+            message.get("data").and_then(|data| data.as_object()),
+        ) {
+            (Some(message_type), Some(data)) => (message_type, data),
+            _ => {
+                return self.send_error(
+                    ctx,
+                    "400 Bad Request",
+                    "Invalid message",
+                )
+            }
+        };
+        match message_type {
+            "setProperty" => {
+                for (name, value) in data {
+                    let res = write_thing(&self.thing)
+                        .set_property(name.clone(), value.clone());
+                    if let Err(err) = res {
+                        self.send_error(ctx, "400 Bad Request", err);
+                    }
+                }
+            }
+            "requestAction" => {
+                for (name, params) in data {
+                    match request_action(
+                        &self.thing,
+                        &*self.action_generator,
+                        name.clone(),
+                        params.get("input").cloned(),
+                    ) {
+                        Ok(_) => {}
+                        Err(ActionRefused::PoolFull) => self.send_error(
+                            ctx,
+                            "503 Service Unavailable",
+                            "Action pool is full",
+                        ),
+                        Err(ActionRefused::Invalid) => self.send_error(
+                            ctx,
+                            "400 Bad Request",
+                            "Invalid action request",
+                        ),
+                    }
+                }
+            }
+            "addEventSubscription" => {
+                let mut thing = write_thing(&self.thing);
+                for name in data.keys() {
+                    thing.add_event_subscriber(name.clone(), self.id.clone());
+                }
+            }
+            _ => self.send_error(
+                ctx,
+                "400 Bad Request",
+                &format!("Unknown messageType: {}", message_type),
+            ),
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_set_href_prefix(
-    property: *mut Box<dyn Property>,
-    prefix: *const c_char,
-) {
-    undbox!(|mut property: Property| {
-        property.set_href_prefix(cstr_to_str!(prefix));
-    });
+impl Actor for ThingSocket {
+    type Context = actix_web_actors::ws::WebsocketContext<Self>;
+
+    fn started(&mut self, ctx: &mut Self::Context) {
+        write_thing(&self.thing).add_subscriber(self.id.clone());
+        ctx.run_interval(SOCKET_INTERVAL, |socket, ctx| {
+            let messages: Vec<String> = write_thing(&socket.thing)
+                .drain_queue(socket.id.clone())
+                .into_iter()
+                .flatten()
+                .collect();
+            for message in messages {
+                if !socket.cbor {
+                    ctx.text(message);
+                } else if let Ok(message) = serde_json::from_str(&message) {
+                    socket.send(ctx, &message);
+                }
+            }
+        });
+    }
+
+    fn stopped(&mut self, _: &mut Self::Context) {
+        write_thing(&self.thing).remove_subscriber(self.id.clone());
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_set_value(
-    property: *mut Box<dyn Property>,
-    value: *const c_char,
-) -> *const c_char {
-    undbox!(|mut property: Property| {
-        result_to_cstr!(property.set_value(cstr_to_json!(value)))
-    })
+impl
+    StreamHandler<
+        Result<
+            actix_web_actors::ws::Message,
+            actix_web_actors::ws::ProtocolError,
+        >,
+    > for ThingSocket
+{
+    fn handle(
+        &mut self,
+        message: Result<
+            actix_web_actors::ws::Message,
+            actix_web_actors::ws::ProtocolError,
+        >,
+        ctx: &mut Self::Context,
+    ) {
+        use actix_web_actors::ws::Message;
+        let message = match message {
+            Ok(Message::Binary(body)) => cbor_to_json(&body),
+            Ok(Message::Text(text)) => serde_json::from_str(&text).ok(),
+            Ok(Message::Ping(body)) => return ctx.pong(&body),
+            Ok(Message::Close(reason)) => {
+                ctx.close(reason);
+                return ctx.stop();
+            }
+            Ok(_) => return,
+            Err(_) => return ctx.stop(),
+        };
+        match message {
+            Some(message) => self.dispatch(ctx, message),
+            None => self.send_error(
+                ctx,
+                "400 Bad Request",
+                "Parsing request failed",
+            ),
+        }
+    }
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_set_cached_value(
-    property: *mut Box<dyn Property>,
-    value: *const c_char,
-) -> *const c_char {
-    undbox!(|mut property: Property| {
-        result_to_cstr!(property.set_cached_value(cstr_to_json!(value)))
-    })
+fn single_thing(thing: *mut RwLock<Box<dyn Thing>>) -> ThingsType {
+    let thingl = unsafe { Arc::from_raw(thing) };
+    let thing = Arc::clone(&thingl);
+    mem::forget(thingl);
+    ThingsType::Single(thing)
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_as_property_description(
-    property: *mut Box<dyn Property>,
-) -> *const c_char {
-    undbox!(|property: Property| {
-        json_to_cstr!(&property.as_property_description())
-    })
+fn multiple_things(
+    things: *mut webthing_thing_lock_arr,
+    name: *const c_char,
+) -> ThingsType {
+    let thingsl: Vec<Arc<RwLock<Box<dyn Thing>>>> =
+        webthing_thing_lock_arr_to_thing_lock_vec!(things);
+    let things: Vec<Arc<RwLock<Box<dyn Thing>>>> = thingsl
+        .into_iter()
+        .map(|t| {
+            let res = Arc::clone(&t);
+            mem::forget(t);
+            res
+        })
+        .collect();
+    ThingsType::Multiple(things, cstr_to_str!(name))
 }
 
-#[no_mangle]
-pub extern "C" fn webthing_property_validate_value(
-    property: *mut Box<dyn Property>,
-    value: *const c_char,
-) -> *const c_char {
-    undbox!(|property: Property| {
-        result_to_cstr!(property.validate_value(&cstr_to_json!(value)))
-    })
+pub struct webthing_server {
+    server: actix_web::dev::Server,
+    system: System,
+    thread: thread::JoinHandle<()>,
+    registry: Arc<ThingRegistry>,
 }
 
-// Server functions
+fn spawn_server(
+    things: ThingsType,
+    options: ServerOptions,
+) -> *const webthing_server {
+    let registry = options.registry(&things);
+    let configure = options.configure(&registry);
+    let (tx, rx) = mpsc::channel();
+    let thread = thread::spawn(move || {
+        // Threads inherit the affinity of the thread creating them, and
+        // actix sizes its worker pool by the number of CPUs available to
+        // this thread.
+        if options.cpu_affinity != 0 && !set_cpu_affinity(options.cpu_affinity)
+        {
+            return;
+        }
+        let sys = System::new("");
+        let mut server = options.into_server(things);
+        let handle = server.start(configure);
+        tx.send((handle, System::current())).unwrap();
+        sys.run().unwrap();
+    });
+    match rx.recv() {
+        Err(_) => {
+            // The server thread ended before it was listening, i.e.
+            // because the port is already in use or the CPU affinity was
+            // rejected.
+            let _ = thread.join();
+            ptr::null()
+        }
+        Ok((server, system)) => {
+            to_box!(webthing_server { server, system, thread, registry })
+        }
+    }
+}
 
 #[no_mangle]
 pub extern "C" fn webthing_server_start_single(
@@ -1027,30 +5170,19 @@ pub extern "C" fn webthing_server_start_single(
     disable_host_validation: bool,
 ) {
     let sys = System::new("");
-
-    let thingl = unsafe { Arc::from_raw(thing) };
-    let thing = Arc::clone(&thingl);
-    mem::forget(thingl);
-    let port = if port == 0 { None } else { Some(port) };
-    let ssl_options =
-        to_opt!(ssl_options, unsafe { Box::from_raw(ssl_options) })
-            .map(|e| e.convert());
-    let c_action_generator = unsafe { Box::from_raw(action_generator) };
-    let action_generator = Box::new(webthing_action_generator {
-        generate: c_action_generator.generate,
-    });
-    mem::forget(c_action_generator);
-
-    let mut server = WebThingServer::new(
-        ThingsType::Single(thing),
+    let server = ServerOptions::new(
         port,
-        to_opt!(cstr_to_str!(hostname)),
+        hostname,
         ssl_options,
         action_generator,
-        to_opt!(cstr_to_str!(base_path)),
-        Some(disable_host_validation),
+        base_path,
+        disable_host_validation,
+        ptr::null(),
     );
-    server.start(None);
+    let thing = single_thing(thing);
+    let configure = server.configure(&server.registry(&thing));
+    let mut server = server.into_server(thing);
+    server.start(configure);
     sys.run().unwrap();
 }
 
@@ -1066,45 +5198,123 @@ pub extern "C" fn webthing_server_start_multiple(
     disable_host_validation: bool,
 ) {
     let sys = System::new("");
-    let thingsl: Vec<Arc<RwLock<Box<dyn Thing>>>> =
-        webthing_thing_lock_arr_to_thing_lock_vec!(things);
-    let things: Vec<Arc<RwLock<Box<dyn Thing>>>> = thingsl
-        .into_iter()
-        .map(|t| {
-            let res = Arc::clone(&t);
-            mem::forget(t);
-            res
-        })
-        .collect();
-    let port = if port == 0 { None } else { Some(port) };
-    let ssl_options =
-        to_opt!(ssl_options, unsafe { Box::from_raw(ssl_options) })
-            .map(|e| e.convert());
-    let c_action_generator = unsafe { Box::from_raw(action_generator) };
-    let action_generator = Box::new(webthing_action_generator {
-        generate: c_action_generator.generate,
-    });
-    mem::forget(c_action_generator);
-
-    let mut server = WebThingServer::new(
-        ThingsType::Multiple(things, cstr_to_str!(name)),
+    let server = ServerOptions::new(
         port,
-        to_opt!(cstr_to_str!(hostname)),
+        hostname,
         ssl_options,
         action_generator,
-        to_opt!(cstr_to_str!(base_path)),
-        Some(disable_host_validation),
+        base_path,
+        disable_host_validation,
+        ptr::null(),
     );
-    server.start(None);
+    let things = multiple_things(things, name);
+    let configure = server.configure(&server.registry(&things));
+    let mut server = server.into_server(things);
+    server.start(configure);
     sys.run().unwrap();
 }
 
+#[no_mangle]
+pub extern "C" fn webthing_server_spawn_single(
+    thing: *mut RwLock<Box<dyn Thing>>,
+    port: u16,
+    hostname: *const c_char,
+    ssl_options: *mut webthing_ssl_options,
+    action_generator: *mut webthing_action_generator,
+    base_path: *const c_char,
+    disable_host_validation: bool,
+    options: *const webthing_server_options,
+) -> *const webthing_server {
+    spawn_server(
+        single_thing(thing),
+        ServerOptions::new(
+            port,
+            hostname,
+            ssl_options,
+            action_generator,
+            base_path,
+            disable_host_validation,
+            options,
+        ),
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_server_spawn_multiple(
+    things: *mut webthing_thing_lock_arr,
+    name: *const c_char,
+    port: u16,
+    hostname: *const c_char,
+    ssl_options: *mut webthing_ssl_options,
+    action_generator: *mut webthing_action_generator,
+    base_path: *const c_char,
+    disable_host_validation: bool,
+    options: *const webthing_server_options,
+) -> *const webthing_server {
+    spawn_server(
+        multiple_things(things, name),
+        ServerOptions::new(
+            port,
+            hostname,
+            ssl_options,
+            action_generator,
+            base_path,
+            disable_host_validation,
+            options,
+        ),
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_server_stop(
+    server: *mut webthing_server,
+    timeout_ms: u64,
+) -> bool {
+    let server = unsafe { Box::from_raw(server) };
+    let (tx, rx) = mpsc::channel();
+    let handle = server.server.clone();
+    thread::spawn(move || {
+        futures::executor::block_on(handle.stop(true));
+        let _ = tx.send(());
+    });
+    let drained = rx.recv_timeout(Duration::from_millis(timeout_ms)).is_ok();
+    server.registry.clear();
+    server.system.stop();
+    server.thread.join().is_ok() && drained
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_server_add_thing(
+    server: *mut webthing_server,
+    thing: *mut RwLock<Box<dyn Thing>>,
+) -> c_int {
+    let server = unsafe { &*server };
+    let thingl = unsafe { Arc::from_raw(thing) };
+    let thing = Arc::clone(&thingl);
+    mem::forget(thingl);
+    server.registry.add(thing).map_or(-1, |index| index as c_int)
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_server_remove_thing(
+    server: *mut webthing_server,
+    id: *const c_char,
+) -> bool {
+    let server = unsafe { &*server };
+    server.registry.remove(&cstr_to_str!(id))
+}
+
 #[no_mangle]
 pub extern "C" fn webthing_thing_lock_new(
     thing: *mut Box<dyn Thing>,
 ) -> *const RwLock<Box<dyn Thing>> {
     let thing = from_dbox!(thing, Thing);
     let lock = Arc::new(RwLock::new(thing));
+    if let Some(thing) =
+        lock.write().unwrap().as_mut_any().downcast_mut::<webthing_thing>()
+    {
+        thing.this = Arc::downgrade(&lock);
+    }
     Arc::into_raw(lock)
 }
 
@@ -1118,16 +5328,58 @@ pub extern "C" fn webthing_thing_lock_clone(
     Arc::into_raw(lock)
 }
 
+#[no_mangle]
+pub extern "C" fn webthing_thing_update_properties(
+    thingl: *mut RwLock<Box<dyn Thing>>,
+    values: *const webthing_property_value,
+    len: usize,
+) -> *const c_char {
+    let thingl = unsafe { Arc::from_raw(thingl) };
+    let mut err = None;
+    let mut updated = serde_json::Map::new();
+    {
+        let mut thing = write_thing(&thingl);
+        for i in 0..len {
+            let pair = unsafe { &*values.add(i) };
+            let name = cstr_to_str!(pair.name);
+            let value: serde_json::Value = cstr_to_json!(pair.value);
+            let res = match thing.find_property(&name) {
+                None => Err("Property not found"),
+                Some(property) => property.set_cached_value(value.clone()),
+            };
+            match res {
+                Ok(()) => {
+                    updated.insert(name, value);
+                }
+                Err(e) => {
+                    err = err.or(Some(e));
+                }
+            }
+        }
+        if !updated.is_empty() {
+            match thing.as_mut_any().downcast_mut::<webthing_thing>() {
+                Some(t) => t.properties_notify(updated),
+                None => {
+                    for (name, value) in updated {
+                        thing.property_notify(name, value);
+                    }
+                }
+            }
+        }
+    }
+    mem::forget(thingl);
+    from_opt!(str_to_cstr!(err))
+}
+
 #[no_mangle]
 pub extern "C" fn webthing_thing_lock_read(
     thingl: *mut RwLock<Box<dyn Thing>>,
 ) -> *const webthing_thing_read_lock {
     let thingl = unsafe { Arc::from_raw(thingl) };
-    let guard = thingl.read().unwrap();
-    let thing = from_dbox!(&*guard, Thing);
+    let guard = read_thing(&thingl);
     let res = to_box!(webthing_thing_read_lock {
+        thing: &*guard as *const Box<dyn Thing>,
         _guard: to_box!(guard) as *const libc::c_void,
-        thing: to_box!(thing)
     });
     mem::forget(thingl);
     res
@@ -1148,11 +5400,10 @@ pub extern "C" fn webthing_thing_lock_write(
     thingl: *mut RwLock<Box<dyn Thing>>,
 ) -> *const webthing_thing_write_lock {
     let thingl = unsafe { Arc::from_raw(thingl) };
-    let guard = thingl.write().unwrap();
-    let thing = from_dbox!(&*guard, Thing);
+    let guard = write_thing(&thingl);
     let res = to_box!(webthing_thing_write_lock {
+        thing: &*guard as *const Box<dyn Thing>,
         _guard: to_box!(guard) as *const libc::c_void,
-        thing: to_box!(thing)
     });
     mem::forget(thingl);
     res
@@ -1174,10 +5425,9 @@ pub extern "C" fn webthing_action_lock_read(
 ) -> *const webthing_action_read_lock {
     let actionl = unsafe { Arc::from_raw(actionl) };
     let guard = actionl.read().unwrap();
-    let action = from_dbox!(&*guard, Action);
     let res = to_box!(webthing_action_read_lock {
+        action: &*guard as *const Box<dyn Action>,
         _guard: to_box!(guard) as *const libc::c_void,
-        action: to_box!(action)
     });
     mem::forget(actionl);
     res
@@ -1199,10 +5449,9 @@ pub extern "C" fn webthing_action_lock_write(
 ) -> *const webthing_action_write_lock {
     let actionl = unsafe { Arc::from_raw(actionl) };
     let guard = actionl.write().unwrap();
-    let action = from_dbox!(&*guard, Action);
     let res = to_box!(webthing_action_write_lock {
+        action: &*guard as *const Box<dyn Action>,
         _guard: to_box!(guard) as *const libc::c_void,
-        action: to_box!(action)
     });
     mem::forget(actionl);
     res
@@ -1218,6 +5467,71 @@ pub extern "C" fn webthing_action_unlock_write(
     mem::drop(guard);
 }
 
+#[no_mangle]
+pub extern "C" fn webthing_thing_with_read(
+    thingl: *mut RwLock<Box<dyn Thing>>,
+    f: extern "C" fn(thing: *const Box<dyn Thing>, ctx: *mut libc::c_void),
+    ctx: *mut libc::c_void,
+) {
+    let guard = read_thing(unsafe { &*thingl });
+    f(&*guard, ctx);
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_thing_with_write(
+    thingl: *mut RwLock<Box<dyn Thing>>,
+    f: extern "C" fn(thing: *mut Box<dyn Thing>, ctx: *mut libc::c_void),
+    ctx: *mut libc::c_void,
+) {
+    let mut guard = write_thing(unsafe { &*thingl });
+    f(&mut *guard, ctx);
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_with_read(
+    actionl: *mut RwLock<Box<dyn Action>>,
+    f: extern "C" fn(action: *const Box<dyn Action>, ctx: *mut libc::c_void),
+    ctx: *mut libc::c_void,
+) {
+    let guard = unsafe { &*actionl }.read().unwrap();
+    f(&*guard, ctx);
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_action_with_write(
+    actionl: *mut RwLock<Box<dyn Action>>,
+    f: extern "C" fn(action: *mut Box<dyn Action>, ctx: *mut libc::c_void),
+    ctx: *mut libc::c_void,
+) {
+    let mut guard = unsafe { &*actionl }.write().unwrap();
+    f(&mut *guard, ctx);
+}
+
+// Metrics functions
+
+#[no_mangle]
+pub extern "C" fn webthing_metrics_snapshot() -> webthing_metrics {
+    metrics().snapshot()
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_metrics_render() -> *const c_char {
+    str_to_cstr!(metrics().render())
+}
+
+#[no_mangle]
+pub extern "C" fn webthing_metrics_latencies(
+    action_name: *const c_char,
+) -> webthing_latencies {
+    if ptr::null() == action_name {
+        return metrics().latencies.snapshot();
+    }
+    metrics()
+        .action_latencies(&cstr_to_str!(action_name))
+        .map(|latencies| latencies.snapshot())
+        .unwrap_or_default()
+}
+
 // Free functions
 
 #[no_mangle]
@@ -1264,6 +5578,13 @@ pub extern "C" fn webthing_thing_lock_free(
     mem::drop(unsafe { Arc::from_raw(thing) });
 }
 
+#[no_mangle]
+pub extern "C" fn webthing_property_snapshot_free(
+    snapshot: *const webthing_property_snapshot,
+) {
+    mem::drop(unsafe { Arc::from_raw(snapshot) });
+}
+
 #[no_mangle]
 pub extern "C" fn webthing_action_lock_free(
     action: *const RwLock<Box<dyn Action>>,
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdint.h>
 
 // Shared structs
 
@@ -12,6 +13,16 @@ typedef struct webthing_thing {} webthing_thing;
  */
 typedef struct webthing_thing_lock {} webthing_thing_lock;
 
+/**
+ *  @brief A reference representing the published property values of a thing. Reading it never waits for the thing lock.
+ */
+typedef struct webthing_property_snapshot {} webthing_property_snapshot;
+
+/**
+ *  @brief A reference representing a running server
+ */
+typedef struct webthing_server {} webthing_server;
+
 /**
  *  @brief A reference representing a property
  */
@@ -48,6 +59,14 @@ typedef struct webthing_thing_lock_arr {
     size_t len; /// Size of the array
 } webthing_thing_lock_arr;
 
+/**
+ *  @brief A property name together with a new value
+ */
+typedef struct webthing_property_value {
+    char* name; /// Name of the property
+    char* value; /// Value of the property as JSON-encoded string
+} webthing_property_value;
+
 /**
  *  @brief A SSL setup
  */
@@ -56,11 +75,106 @@ typedef struct webthing_ssl_options {
     char* b;
 } webthing_ssl_options;
 
+/**
+ *  @brief Options for a server started with webthing_server_spawn_single or webthing_server_spawn_multiple
+ */
+typedef struct webthing_server_options {
+    uint64_t cpu_affinity; /// Bit mask of the CPUs the server threads may run on, or 0 for no restriction. One HTTP worker is started per CPU the threads may run on, so the mask also sets the number of workers; the webthing crate offers no other way to set it. The server fails to start if a CPU in the mask is offline or not permitted or on systems other than Linux
+    bool snapshot_reads; /// Serve GET /properties[/<name>] from the property snapshots instead of taking the thing lock
+    bool metrics; /// Serve the process wide metrics in the Prometheus text format at GET /metrics
+} webthing_server_options;
+
+/**
+ *  @brief A notification policy of a property. Used to limit how often subscribers are notified of changes
+ */
+typedef struct webthing_notify_policy {
+    uint64_t min_interval_ms; /// Minimum time between two notifications. Changes within this window are merged into one notification sent when it is over, the last value wins
+    double deadband; /// Numeric changes smaller than this, measured against the last value sent, are not sent. 0 to disable
+    double deadband_relative; /// Numeric changes smaller than this fraction of the last value sent are not sent. 0 to disable
+} webthing_notify_policy;
+
+/**
+ *  @brief Counters of a notification policy
+ */
+typedef struct webthing_notify_stats {
+    uint64_t coalesced; /// Number of changes deferred to the end of their window
+    uint64_t dropped; /// Number of deferred changes never sent because a later one replaced them
+    uint64_t filtered; /// Number of changes not sent because they were within the deadband or repeated the last value sent
+} webthing_notify_stats;
+
+/**
+ *  @brief Process wide metrics, see webthing_metrics_snapshot
+ */
+typedef struct webthing_metrics {
+    uint64_t property_reads; /// Property reads, including GET /properties requests
+    uint64_t property_writes; /// Property writes, including PUT requests
+    uint64_t description_reads; /// Thing descriptions requested
+    uint64_t actions_requested; /// Actions requested through the action generator
+    uint64_t actions_rejected; /// Actions refused by the action generator or the action pool
+    uint64_t actions_completed; /// Actions finished
+    uint64_t actions_queued; /// Actions currently waiting for an action pool worker
+    uint64_t actions_running; /// Actions currently being performed by the action pool
+    uint64_t subscribers; /// Websocket subscribers currently connected
+    uint64_t notifications; /// Property notifications sent to subscribers
+    uint64_t notify_fanout; /// Subscribers reached by those notifications, summed up
+    uint64_t notify_fanout_max; /// Most subscribers reached by a single notification
+    uint64_t lock_read_waits; /// Thing read locks taken
+    uint64_t lock_read_wait_ns; /// Time spent waiting for thing read locks
+    uint64_t lock_read_wait_max_ns; /// Longest wait for a thing read lock
+    uint64_t lock_write_waits; /// Thing write locks taken
+    uint64_t lock_write_wait_ns; /// Time spent waiting for thing write locks
+    uint64_t lock_write_wait_max_ns; /// Longest wait for a thing write lock
+} webthing_metrics;
+
+/**
+ *  @brief Distribution of the durations recorded in a latency histogram. Percentiles are reported at most 1/16th too high
+ */
+typedef struct webthing_latency {
+    uint64_t count; /// Number of recorded durations
+    uint64_t total_ns; /// Sum of all recorded durations
+    uint64_t mean_ns; /// Mean duration
+    uint64_t p50_ns; /// Median duration
+    uint64_t p90_ns; /// 90th percentile
+    uint64_t p99_ns; /// 99th percentile
+    uint64_t p999_ns; /// 99.9th percentile
+    uint64_t max_ns; /// Longest duration
+} webthing_latency;
+
+/**
+ *  @brief Latencies of the C callbacks and of the action lifecycle, see webthing_metrics_latencies
+ */
+typedef struct webthing_latencies {
+    webthing_latency set_value; /// webthing_value_forwarder.set_value callbacks
+    webthing_latency generate; /// webthing_action_generator.generate callbacks
+    webthing_latency perform_action; /// perform_action callbacks of actions
+    webthing_latency cancel; /// cancel callbacks of actions
+    webthing_latency queued; /// From an action being created until its perform_action callback is called
+    webthing_latency running; /// From the perform_action callback being called until the action is finished
+    webthing_latency total; /// From an action being created until it is finished
+} webthing_latencies;
+
+/**
+ *  @brief Pending completion of webthing_value_forwarder.set_value_async, see webthing_value_forwarder_complete
+ */
+typedef struct webthing_value_token webthing_value_token;
+
 /**
  *  @brief A value forwarder. Used to handle property changes reported by the gateway.
+ *
+ *  Set either set_value or set_value_async. If set_value_async is set, it is used and has to return quickly;
+ *  the new value is reported later on by calling webthing_value_forwarder_complete with the token, from any thread.
+ *  A PUT request from the gateway is answered only once the value was completed, without holding the thing lock or blocking the server in the meantime.
+ *  If the value isn't completed within 5 seconds, the request is answered with 504 Gateway Timeout instead.
+ *  A setProperty message received over a websocket doesn't wait either; the value is set and notified to the subscribers once completed, or dropped after the same 5 seconds.
+ *  Either way, every token has to be completed exactly once, even after the server stopped waiting for it; only then is it freed.
+ *
+ *  ABI: set_value_async was added after set_value, which made this struct larger. Code compiled against an older libwebthing.h must be rebuilt,
+ *  and a forwarder that isn't fully initialized (e.g. allocated with malloc) must set set_value_async to null explicitly, as it's used whenever it's not null.
+ *  Any other caller (e.g. webthing_thing_set_property) blocks until completion while holding its lock, so don't wait for that same lock before completing.
  */
 typedef struct webthing_value_forwarder {
     char* (*set_value) (char* value); /// Gets called whenever a property change was reported by the gateway
+    void (*set_value_async) (webthing_value_token* token, char* value); /// Same, but completed through webthing_value_forwarder_complete. Don't forget to call webthing_str_free on value!
 } webthing_value_forwarder;
 
 /**
@@ -117,6 +231,8 @@ webthing_thing* webthing_thing_new(char* id, char* title, webthing_str_arr* capa
 
 /**
 * Return the thing state as a Thing Description.
+* The description is rendered once and kept until properties, available actions or events are added or removed, or the hrefs of the thing or its properties change.
+* The servers keep the serialized description as served over HTTP the same way, for up to 8 distinct hosts per thing.
 *
 * @param thing pointer to the thing
 * @return thing state as JSON-encoded string. Don't forget to call webthing_str_free!
@@ -131,6 +247,16 @@ char* webthing_thing_as_thing_description(webthing_thing* thing);
 */
 char* webthing_thing_get_href(webthing_thing* thing);
 
+/**
+* Copy the thing's href into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's href in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_href_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the thing's href prefix, i.e. /0.
 *
@@ -139,6 +265,16 @@ char* webthing_thing_get_href(webthing_thing* thing);
 */
 char* webthing_thing_get_href_prefix(webthing_thing* thing);
 
+/**
+* Copy the thing's href prefix into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's href prefix in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_href_prefix_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the UI href.
 *
@@ -147,6 +283,16 @@ char* webthing_thing_get_href_prefix(webthing_thing* thing);
 */
 char* webthing_thing_get_ui_href(webthing_thing* thing);
 
+/**
+* Copy the thing's UI href into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's UI href in bytes, not counting the terminating null byte, or -1 if not set. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_ui_href_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Set the prefix of any hrefs associated with the thing.
 *
@@ -171,6 +317,16 @@ void webthing_thing_set_ui_href(webthing_thing* thing, char* href);
 */
 char* webthing_thing_get_id(webthing_thing* thing);
 
+/**
+* Copy the thing's ID into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's ID in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_id_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the title of the thing.
 *
@@ -179,6 +335,16 @@ char* webthing_thing_get_id(webthing_thing* thing);
 */
 char* webthing_thing_get_title(webthing_thing* thing);
 
+/**
+* Copy the thing's title into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's title in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_title_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the type context of the thing.
 *
@@ -187,6 +353,16 @@ char* webthing_thing_get_title(webthing_thing* thing);
 */
 char* webthing_thing_get_context(webthing_thing* thing);
 
+/**
+* Copy the thing's type context into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's type context in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_context_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the capability type(s) of the thing.
 *
@@ -203,6 +379,16 @@ webthing_str_arr* webthing_thing_get_capabilities(webthing_thing* thing);
 */
 char* webthing_thing_get_description(webthing_thing* thing);
 
+/**
+* Copy the thing's description into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the thing's description in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_thing_get_description_buf(webthing_thing* thing, char* buf, size_t size);
+
 /**
 * Get the thing's properties as a JSON map.
 *
@@ -227,6 +413,20 @@ char* webthing_thing_get_action_descriptions(webthing_thing* thing, char* action
 */
 char* webthing_thing_get_event_descriptions(webthing_thing* thing, char* event_name);
 
+/**
+* Get the thing's events added after a given one as an array, oldest first.
+*
+* Served over HTTP as GET /events[/<name>]?since=<since>&limit=<limit>, with the sequence number of the last returned event in the X-Last-Event header.
+*
+* @param thing pointer to the thing
+* @param event_name name of the event as string, or null to get events of all types
+* @param since sequence number of the last event already seen, or 0 to start from the oldest retained event
+* @param limit maximum number of events to return, or 0 for no limit
+* @param last optional pointer that receives the sequence number of the last returned event, to be passed as since on the next call
+* @return thing's events as a JSON-encoded string. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_get_event_descriptions_since(webthing_thing* thing, char* event_name, uint64_t since, size_t limit, uint64_t* last);
+
 /**
 * Add a property to this thing.
 *
@@ -260,6 +460,46 @@ char* webthing_thing_get_property(webthing_thing* thing, char* property_name);
 */
 char* webthing_thing_get_properties(webthing_thing* thing);
 
+/**
+* Copy a mapping of all properties and their values, encoded as CBOR (RFC 8949), into a caller-provided buffer. Floats are encoded in single precision if that is lossless.
+* The same encoding is served over HTTP on the property, action and event endpoints to clients sending "Accept: application/cbor", both for reads and for the responses to property writes and action requests. CBOR is chosen when application/cbor is listed with a nonzero quality no lower than that of application/json.
+* Property writes and action requests may send their body as CBOR with "Content-Type: application/cbor".
+* A websocket opened with "Accept: application/cbor" sends its messages as binary CBOR frames and accepts binary CBOR or JSON text frames.
+*
+* @param thing pointer to the thing
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the encoded mapping in bytes. The result was truncated if this is greater than size
+*/
+int webthing_thing_get_properties_cbor(webthing_thing* thing, uint8_t* buf, size_t size);
+
+/**
+* Get the property snapshot of a thing.
+* Property values are published to the snapshot whenever they are set or notified through the thing, or set through the handle of a property added to the thing, e.g. with webthing_property_set_cached_value.
+* Reading the snapshot never waits for a lock: the published values are swapped atomically.
+*
+* @param thing pointer to the thing
+* @return pointer to the property snapshot. Don't forget to call webthing_property_snapshot_free!
+*/
+webthing_property_snapshot* webthing_thing_get_property_snapshot(webthing_thing* thing);
+
+/**
+* Get a mapping of all published properties and their values. Does not take the thing lock.
+*
+* @param snapshot pointer to the property snapshot
+* @return the mapping as a JSON-encoded string. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_snapshot_get_properties(webthing_property_snapshot* snapshot);
+
+/**
+* Get a published property value. Does not take the thing lock.
+*
+* @param snapshot pointer to the property snapshot
+* @param name name of the property as string
+* @return the value as JSON-encoded string, or null if no property with the given name was published. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_snapshot_get_property(webthing_property_snapshot* snapshot, char* name);
+
 /**
 * Determine whether or not this thing has a given property.
 *
@@ -279,23 +519,236 @@ bool webthing_thing_has_property(webthing_thing* thing, char* property_name);
 */
 char* webthing_thing_set_property(webthing_thing* thing, char* property_name, char* value);
 
+/**
+* Set a property value without going through JSON.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param value value as boolean
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_bool(webthing_thing* thing, char* property_name, bool value);
+
+/**
+* Set a property value without going through JSON.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param value value as integer
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_i64(webthing_thing* thing, char* property_name, int64_t value);
+
+/**
+* Set a property value without going through JSON.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param value value as number
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_f64(webthing_thing* thing, char* property_name, double value);
+
+/**
+* Set a property value without going through JSON.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param value value as string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_str(webthing_thing* thing, char* property_name, char* value);
+
 /**
 * Set a property value.
 *
 * @param thing pointer to the thing
 * @param property_name name of the property as string
-* @return pointer to the desired property, or null if no property with the given name exists.
+* @return pointer to the desired property, or null if no property with the given name exists. The property is borrowed from the thing: it stays valid until a property is added to or removed from the thing, and must not be freed.
 */
 webthing_property* webthing_thing_find_property(webthing_thing* thing, char* property_name);
 
+/**
+* Resolve a property name to an index, so hot paths can skip the name lookup. The index stays valid for the lifetime of the thing, but functions taking it report the property as not found once it was removed.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @return index of the property, or -1 if no property with the given name exists
+*/
+int webthing_thing_property_index(webthing_thing* thing, char* property_name);
+
+/**
+* Get a property's value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @return the properties value as a JSON-encoded string, or "null" if no such propery exists. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_get_property_at(webthing_thing* thing, int index);
+
+/**
+* Set a property value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as JSON-encoded string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_at(webthing_thing* thing, int index, char* value);
+
+/**
+* Set a property value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as boolean
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_at_bool(webthing_thing* thing, int index, bool value);
+
+/**
+* Set a property value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as integer
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_at_i64(webthing_thing* thing, int index, int64_t value);
+
+/**
+* Set a property value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as number
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_at_f64(webthing_thing* thing, int index, double value);
+
+/**
+* Set a property value by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_property_at_str(webthing_thing* thing, int index, char* value);
+
+/**
+* Set the cached value of a property by index, like webthing_property_set_cached_value.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as JSON-encoded string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_cached_value_at(webthing_thing* thing, int index, char* value);
+
+/**
+* Set the cached value of a property by index, like webthing_property_set_cached_value.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as boolean
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_cached_value_at_bool(webthing_thing* thing, int index, bool value);
+
+/**
+* Set the cached value of a property by index, like webthing_property_set_cached_value.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as integer
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_cached_value_at_i64(webthing_thing* thing, int index, int64_t value);
+
+/**
+* Set the cached value of a property by index, like webthing_property_set_cached_value.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as number
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_cached_value_at_f64(webthing_thing* thing, int index, double value);
+
+/**
+* Set the cached value of a property by index, like webthing_property_set_cached_value.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value as string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_set_cached_value_at_str(webthing_thing* thing, int index, char* value);
+
+/**
+* Notify all subscribers of a property change by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value of the property as JSON-encoded string
+*/
+void webthing_thing_property_notify_at(webthing_thing* thing, int index, char* value);
+
+/**
+* Notify all subscribers of a property change by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value of the property as boolean
+*/
+void webthing_thing_property_notify_at_bool(webthing_thing* thing, int index, bool value);
+
+/**
+* Notify all subscribers of a property change by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value of the property as integer
+*/
+void webthing_thing_property_notify_at_i64(webthing_thing* thing, int index, int64_t value);
+
+/**
+* Notify all subscribers of a property change by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value of the property as number
+*/
+void webthing_thing_property_notify_at_f64(webthing_thing* thing, int index, double value);
+
+/**
+* Notify all subscribers of a property change by index.
+*
+* @param thing pointer to the thing
+* @param index index of the property, as returned by webthing_thing_property_index
+* @param value value of the property as string
+*/
+void webthing_thing_property_notify_at_str(webthing_thing* thing, int index, char* value);
+
 /**
 * Add a new event and notify subscribers.
+* If more events of this type are retained than the capacity allows, the oldest ones are freed.
 *
 * @param thing pointer to the thing
 * @param event pointer to the event. The thing will take over ownership of it, so please do not free!
 */
 void webthing_thing_add_event(webthing_thing* thing, webthing_event* event);
 
+/**
+* Set how many events the thing retains. By default, all events are retained.
+*
+* @param thing pointer to the thing
+* @param event_name name of the event as string, or null to set the capacity for all event types without an own capacity
+* @param capacity maximum number of retained events per type, or 0 for no limit
+*/
+void webthing_thing_set_event_capacity(webthing_thing* thing, char* event_name, size_t capacity);
+
 /**
 * Add an available event.
 *
@@ -335,6 +788,17 @@ char* webthing_thing_add_action(webthing_thing* thing, webthing_action* action,
 */
 bool webthing_thing_remove_action(webthing_thing* thing, char* action_name, char* action_id);
 
+/**
+* Set how long the thing retains completed actions. Actions finished through webthing_thing_finish_action are removed automatically once the policy no longer retains them.
+* Expired actions are evicted whenever an action is added or finished and when the actions are requested over HTTP.
+* By default, completed actions are retained until they are removed.
+*
+* @param thing pointer to the thing
+* @param max_completed maximum number of retained completed actions per action name, or 0 for no limit
+* @param max_age_ms time in milliseconds after which a completed action is removed, or 0 for no limit
+*/
+void webthing_thing_set_action_retention(webthing_thing* thing, size_t max_completed, uint64_t max_age_ms);
+
 /**
 * Add an available action.
 *
@@ -344,6 +808,52 @@ bool webthing_thing_remove_action(webthing_thing* thing, char* action_name, char
 */
 void webthing_thing_add_available_action(webthing_thing* thing, char* name, char* metadata);
 
+/**
+* Set the notification policy of a property.
+* The policy applies to all notifications of the property, including those of webthing_thing_set_property.
+* Changes that are not sent still update the property value.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param policy pointer to the policy, or null to remove the policy and send a pending notification right away
+*/
+void webthing_thing_set_notify_policy(webthing_thing* thing, char* property_name, webthing_notify_policy* policy);
+
+/**
+* Get the counters of the notification policy of a property.
+*
+* @param thing pointer to the thing
+* @param property_name name of the property as string
+* @param stats pointer that receives the counters
+* @return whether or not the property has a notification policy
+*/
+bool webthing_thing_get_notify_stats(webthing_thing* thing, char* property_name, webthing_notify_stats* stats);
+
+/**
+* Add a websocket subscriber. Usually the server does this for every websocket connected to the thing.
+*
+* @param thing pointer to the thing
+* @param ws_id id of the subscriber as string
+*/
+void webthing_thing_add_subscriber(webthing_thing* thing, char* ws_id);
+
+/**
+* Remove a websocket subscriber.
+*
+* @param thing pointer to the thing
+* @param ws_id id of the subscriber as string
+*/
+void webthing_thing_remove_subscriber(webthing_thing* thing, char* ws_id);
+
+/**
+* Take all messages queued for a subscriber.
+*
+* @param thing pointer to the thing
+* @param ws_id id of the subscriber as string
+* @return the queued messages as JSON-encoded strings. Don't forget to call webthing_str_arr_free!
+*/
+webthing_str_arr* webthing_thing_drain_queue(webthing_thing* thing, char* ws_id);
+
 /**
 * Notify all subscribers of a property change.
 *
@@ -353,6 +863,42 @@ void webthing_thing_add_available_action(webthing_thing* thing, char* name, char
 */
 void webthing_thing_property_notify(webthing_thing* thing, char* name, char* value);
 
+/**
+* Notify all subscribers of a property change without going through JSON.
+*
+* @param thing pointer to the thing
+* @param name name of the property as string
+* @param value value of the property as boolean
+*/
+void webthing_thing_property_notify_bool(webthing_thing* thing, char* name, bool value);
+
+/**
+* Notify all subscribers of a property change without going through JSON.
+*
+* @param thing pointer to the thing
+* @param name name of the property as string
+* @param value value of the property as integer
+*/
+void webthing_thing_property_notify_i64(webthing_thing* thing, char* name, int64_t value);
+
+/**
+* Notify all subscribers of a property change without going through JSON.
+*
+* @param thing pointer to the thing
+* @param name name of the property as string
+* @param value value of the property as number
+*/
+void webthing_thing_property_notify_f64(webthing_thing* thing, char* name, double value);
+
+/**
+* Notify all subscribers of a property change without going through JSON.
+*
+* @param thing pointer to the thing
+* @param name name of the property as string
+* @param value value of the property as string
+*/
+void webthing_thing_property_notify_str(webthing_thing* thing, char* name, char* value);
+
 /**
 * Notify all subscribers of an action status change.
 *
@@ -372,6 +918,8 @@ void webthing_thing_event_notify(webthing_thing* thing, char* name, char* event)
 
 /**
 * Start the specified action.
+* The perform callback of the action is queued on the action pool and runs on one of its worker threads without any locks held.
+* If the queue is full, the action's status is set to "rejected" instead.
 *
 * @param thing pointer to the thing
 * @param name name of the action as string
@@ -428,6 +976,16 @@ void webthing_action_set_href_prefix(webthing_action* action, char* perfix);
 */
 char* webthing_action_get_id(webthing_action* action);
 
+/**
+* Copy the id of the action into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the id of the action in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_action_get_id_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the action's name.
 *
@@ -436,6 +994,16 @@ char* webthing_action_get_id(webthing_action* action);
 */
 char* webthing_action_get_name(webthing_action* action);
 
+/**
+* Copy the name of the action into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the name of the action in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_action_get_name_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the action's href.
 *
@@ -444,6 +1012,16 @@ char* webthing_action_get_name(webthing_action* action);
 */
 char* webthing_action_get_href(webthing_action* action);
 
+/**
+* Copy the href of the action into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the href of the action in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_action_get_href_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the action's status.
 *
@@ -452,6 +1030,16 @@ char* webthing_action_get_href(webthing_action* action);
 */
 char* webthing_action_get_status(webthing_action* action);
 
+/**
+* Copy the status of the action into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the status of the action in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_action_get_status_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the time the action was requested.
 *
@@ -460,6 +1048,16 @@ char* webthing_action_get_status(webthing_action* action);
 */
 char* webthing_action_get_time_requested(webthing_action* action);
 
+/**
+* Copy the time the action was requested into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the time the action was requested in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_action_get_time_requested_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the time the action was completed.
 *
@@ -468,6 +1066,16 @@ char* webthing_action_get_time_requested(webthing_action* action);
 */
 char* webthing_action_get_time_completed(webthing_action* action);
 
+/**
+* Copy the time the action was completed into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param action pointer to the action
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the time the action was completed in bytes, not counting the terminating null byte, or -1 if not set. The result was truncated if this is not less than size
+*/
+int webthing_action_get_time_completed_buf(webthing_action* action, char* buf, size_t size);
+
 /**
 * Get the inputs for the action.
 *
@@ -501,6 +1109,7 @@ void webthing_action_start(webthing_action* action);
 
 /**
 * Perform the action.
+* The perform callback runs synchronously on the calling thread.
 *
 * @param action pointer to the action
 */
@@ -520,6 +1129,25 @@ void webthing_action_cancel(webthing_action* action);
 */
 void webthing_action_finish(webthing_action* action);
 
+/**
+* Configure the pool that performs started actions.
+* By default, the pool uses 4 worker threads and a queue depth of 64.
+* While the queue is full, the server answers new action requests with 503 Service Unavailable and a Retry-After header.
+*
+* @param workers maximum number of worker threads
+* @param queue_depth maximum number of actions waiting for a worker
+*/
+void webthing_action_pool_configure(size_t workers, size_t queue_depth);
+
+/**
+* Limit how many actions of a type the action pool performs concurrently.
+* Further actions of this type stay queued until a running one returns.
+*
+* @param action_name name of the action as string
+* @param limit maximum number of concurrently performed actions, or 0 for no limit
+*/
+void webthing_action_pool_set_limit(char* action_name, size_t limit);
+
 /**
 * Get the action description.
 *
@@ -547,6 +1175,16 @@ webthing_event* webthing_event_new(char* name, char* data);
 */
 char* webthing_event_get_name(webthing_event* event);
 
+/**
+* Copy the name of the event into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param event pointer to the event
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the name of the event in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_event_get_name_buf(webthing_event* event, char* buf, size_t size);
+
 /**
 * Get the event's data.
 *
@@ -563,6 +1201,16 @@ char* webthing_event_get_data(webthing_event* event);
 */
 char* webthing_event_get_time(webthing_event* event);
 
+/**
+* Copy the time of the event into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param event pointer to the event
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the time of the event in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_event_get_time_buf(webthing_event* event, char* buf, size_t size);
+
 /**
 * Get the event description.
 *
@@ -586,6 +1234,7 @@ webthing_property* webthing_property_new(char* name, char* initial_value, webthi
 
 /**
 * Set the prefix of any hrefs associated with this property.
+* If the property was added to a thing, the thing description is rendered again.
 *
 * @param property pointer to the property
 * @param perfix prefix as string
@@ -600,6 +1249,16 @@ void webthing_property_set_href_prefix(webthing_property* property, char* perfix
 */
 char* webthing_property_get_href(webthing_property* property);
 
+/**
+* Copy the property's href into a caller-provided buffer instead of returning a string that needs to be freed. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param property pointer to the property
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the property's href in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_property_get_href_buf(webthing_property* property, char* buf, size_t size);
+
 /**
 * Get the current property value.
 *
@@ -608,6 +1267,41 @@ char* webthing_property_get_href(webthing_property* property);
 */
 char* webthing_property_get_value(webthing_property* property);
 
+/**
+* Get the current property value as boolean.
+*
+* @param property pointer to the property
+* @param value pointer the value gets written to
+* @return whether or not the value could be represented as boolean. value is left untouched otherwise
+*/
+bool webthing_property_get_value_bool(webthing_property* property, bool* value);
+
+/**
+* Get the current property value as integer.
+*
+* @param property pointer to the property
+* @param value pointer the value gets written to
+* @return whether or not the value could be represented as integer. value is left untouched otherwise
+*/
+bool webthing_property_get_value_i64(webthing_property* property, int64_t* value);
+
+/**
+* Get the current property value as number.
+*
+* @param property pointer to the property
+* @param value pointer the value gets written to
+* @return whether or not the value could be represented as number. value is left untouched otherwise
+*/
+bool webthing_property_get_value_f64(webthing_property* property, double* value);
+
+/**
+* Get the current property value as string.
+*
+* @param property pointer to the property
+* @return property's value as string, or null if the value is not a string. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_get_value_str(webthing_property* property);
+
 /**
 * Set the current value of the property.
 *
@@ -627,13 +1321,59 @@ char* webthing_property_set_value(webthing_property* property, char* value);
 char* webthing_property_set_cached_value(webthing_property* property, char* value);
 
 /**
-* Get the name of this property.
+* Set the cached value of the property without going through JSON.
 *
 * @param property pointer to the property
-* @return property's name as string. Don't forget to call webthing_str_free!
+* @param value value as boolean
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_set_cached_value_bool(webthing_property* property, bool value);
+
+/**
+* Set the cached value of the property without going through JSON.
+*
+* @param property pointer to the property
+* @param value value as integer
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_set_cached_value_i64(webthing_property* property, int64_t value);
+
+/**
+* Set the cached value of the property without going through JSON.
+*
+* @param property pointer to the property
+* @param value value as number
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_set_cached_value_f64(webthing_property* property, double value);
+
+/**
+* Set the cached value of the property without going through JSON.
+*
+* @param property pointer to the property
+* @param value value as string
+* @return null if the operation was successful, or an error message as string otherwise. Don't forget to call webthing_str_free!
+*/
+char* webthing_property_set_cached_value_str(webthing_property* property, char* value);
+
+/**
+* Get the name of this property, encoded as a JSON string like the other getters: a property named brightness is returned as "\"brightness\"". Use webthing_property_get_name_buf for the name itself.
+*
+* @param property pointer to the property
+* @return property's name as JSON string. Don't forget to call webthing_str_free!
 */
 char* webthing_property_get_name(webthing_property* property);
 
+/**
+* Copy the property's name into a caller-provided buffer instead of returning a string that needs to be freed. Unlike webthing_property_get_name the name is not JSON-encoded, so brightness is written without quotes. Like snprintf, the result is truncated to fit and always null-terminated if size is not zero.
+*
+* @param property pointer to the property
+* @param buf buffer to write to. May be null if size is 0
+* @param size size of the buffer in bytes
+* @return length of the property's name in bytes, not counting the terminating null byte. The result was truncated if this is not less than size
+*/
+int webthing_property_get_name_buf(webthing_property* property, char* buf, size_t size);
+
 /**
 * Get the metadata associated with this property.
 *
@@ -659,6 +1399,14 @@ char* webthing_property_as_property_description(webthing_property* property);
 */
 char* webthing_property_validate_value(webthing_property* property, char* value);
 
+/**
+* Complete a value passed to webthing_value_forwarder.set_value_async. Must be called exactly once for every token, also if it's too late, i.e. the request was already answered with 504 Gateway Timeout; the value is dropped then.
+*
+* @param token token passed to set_value_async; it is freed by this call
+* @param value the value that was actually set as JSON-encoded string, or null if setting it failed
+*/
+void webthing_value_forwarder_complete(webthing_value_token* token, char* value);
+
 // Server functions
 
 /**
@@ -686,7 +1434,69 @@ void webthing_server_start_single(webthing_thing_lock* thing, unsigned short por
 * @param base_path base URL to use as string. Defaults to '/' if set to null.
 * @param disable_host_validation whether or not to disable host validation. Normally, you will just want to set this to false. Note that disabling host validation can lead to DNS rebinding attacks
 */
-void webthing_server_start_multiple(webthing_thing_lock_arr* things, char* name, unsigned short port, char* hostname, webthing_ssl_options* ssl_options, webthing_action_generator* action_generator, char* base_path, bool* disable_host_validation);
+void webthing_server_start_multiple(webthing_thing_lock_arr* things, char* name, unsigned short port, char* hostname, webthing_ssl_options* ssl_options, webthing_action_generator* action_generator, char* base_path, bool disable_host_validation);
+
+/**
+* Create a new WebThingServer for a single thing and start listening for incoming connections on a background thread. Returns as soon as the server is listening.
+*
+* @param thing pointer to the thing lock
+* @param port port to listen on. Defaults to 80 if set to 0
+* @param hostname optional host name as string, i.e. mything.com, that can be set to null
+* @param ssl_options optional pointer to SSL options to pass to the actix web server, that can be set to null
+* @param action_generator pointer to action generator struct
+* @param base_path base URL to use as string. Defaults to '/' if set to null.
+* @param disable_host_validation whether or not to disable host validation. Normally, you will just want to set this to false. Note that disabling host validation can lead to DNS rebinding attacks
+* @param options optional pointer to server options, that can be set to null
+* @return pointer to the running server, or null if the server could not be started, i.e. because the port is in use or the CPU affinity of the options can't be applied. Don't forget to call webthing_server_stop!
+*/
+webthing_server* webthing_server_spawn_single(webthing_thing_lock* thing, unsigned short port, char* hostname, webthing_ssl_options* ssl_options, webthing_action_generator* action_generator, char* base_path, bool disable_host_validation, webthing_server_options* options);
+
+/**
+* Create a new WebThingServer for multiple things and start listening for incoming connections on a background thread. Returns as soon as the server is listening.
+* Things are served at /<index>; except for websockets, the endpoints also accept the thing id in place of the index, e.g. PUT /urn:dev:ops:my-lamp-1234/properties/on.
+* GET / lists the descriptions of all things. With GET /?offset=<offset>&limit=<limit> it lists a page of them instead, and a Link header points to the next page.
+*
+* @param things list of things (as locks) managed by this server
+* @param name name of this device
+* @param port port to listen on. Defaults to 80 if set to 0
+* @param hostname optional host name as string, i.e. mything.com, that can be set to null
+* @param ssl_options optional pointer to SSL options to pass to the actix web server, that can be set to null
+* @param action_generator pointer to action generator struct
+* @param base_path base URL to use as string. Defaults to '/' if set to null.
+* @param disable_host_validation whether or not to disable host validation. Normally, you will just want to set this to false. Note that disabling host validation can lead to DNS rebinding attacks
+* @param options optional pointer to server options, that can be set to null
+* @return pointer to the running server, or null if the server could not be started, i.e. because the port is in use or the CPU affinity of the options can't be applied. Don't forget to call webthing_server_stop!
+*/
+webthing_server* webthing_server_spawn_multiple(webthing_thing_lock_arr* things, char* name, unsigned short port, char* hostname, webthing_ssl_options* ssl_options, webthing_action_generator* action_generator, char* base_path, bool disable_host_validation, webthing_server_options* options);
+
+/**
+* Stop a server started with webthing_server_spawn_single or webthing_server_spawn_multiple. The server stops accepting connections right away and in-flight requests get up to timeout_ms to finish before the remaining connections are dropped. Once this returns, the port can be reused.
+*
+* @param server pointer to the server. It is freed by this call, so please do not use it afterwards!
+* @param timeout_ms time in milliseconds to wait for in-flight requests
+* @return whether or not all connections were drained within the timeout
+*/
+bool webthing_server_stop(webthing_server* server, uint64_t timeout_ms);
+
+/**
+* Add a thing to a running server started with webthing_server_spawn_multiple, without interrupting requests or websocket subscribers of the other things.
+* The thing is served at /<index>: its properties can be read and set, actions requested, read and cancelled, events read, and websockets opened at /<index> to subscribe to it.
+*
+* @param server pointer to the running server
+* @param thing pointer to the thing lock; don't forget to call webthing_thing_lock_free after stopping the server
+* @return the index the thing is served at, or -1 if a thing with the same id is already served or the server serves a single thing
+*/
+int webthing_server_add_thing(webthing_server* server, webthing_thing_lock* thing);
+
+/**
+* Remove a thing from a running server started with webthing_server_spawn_multiple. Its index is not reused, requests for it fail with 404 from now on.
+* Websocket subscribers already connected to the thing stay connected until they close their connection.
+*
+* @param server pointer to the running server
+* @param id id of the thing to remove
+* @return whether or not a thing with this id was served
+*/
+bool webthing_server_remove_thing(webthing_server* server, char* id);
 
 /**
 * Create a new thing lock
@@ -704,6 +1514,16 @@ webthing_thing_lock* webthing_thing_lock_new(webthing_thing* thing);
 */
 webthing_thing_lock* webthing_thing_lock_clone(webthing_thing_lock* thing);
 
+/**
+* Set the cached values of several properties under a single write lock and notify all subscribers with one combined message.
+*
+* @param thing pointer to the thing lock
+* @param values pointer to a classical C array of property name/value pairs
+* @param len size of the array
+* @return null if all properties were updated, or the first error message as string otherwise. Properties that could be updated are updated and notified regardless. Don't forget to call webthing_str_free!
+*/
+char* webthing_thing_update_properties(webthing_thing_lock* thing, webthing_property_value* values, size_t len);
+
 /**
 * Lock a thing lock for read access
 *
@@ -717,7 +1537,7 @@ webthing_thing_read_lock* webthing_thing_lock_read(webthing_thing_lock* thing);
 *
 * @param lock pointer to the thing read lock
 */
-webthing_thing_unlock_read(webthing_thing_read_lock* lock);
+void webthing_thing_unlock_read(webthing_thing_read_lock* lock);
 
 /**
 * Lock a thing lock for write access
@@ -732,7 +1552,7 @@ webthing_thing_write_lock* webthing_thing_lock_write(webthing_thing_lock* thing)
 *
 * @param lock pointer to the thing write lock
 */
-webthing_thing_unlock_write(webthing_thing_write_lock* lock);
+void webthing_thing_unlock_write(webthing_thing_write_lock* lock);
 
 /**
 * Lock a action lock for read access
@@ -747,7 +1567,7 @@ webthing_action_read_lock* webthing_action_lock_read(webthing_action_lock* actio
 *
 * @param lock pointer to the action read lock
 */
-webthing_action_unlock_read(webthing_action_read_lock* lock);
+void webthing_action_unlock_read(webthing_action_read_lock* lock);
 
 /**
 * Lock a action lock for write access
@@ -762,8 +1582,68 @@ webthing_action_write_lock* webthing_action_lock_write(webthing_action_lock* act
 *
 * @param lock pointer to the action write lock
 */
-webthing_action_unlock_write(webthing_action_write_lock* lock);
+void webthing_action_unlock_write(webthing_action_write_lock* lock);
+
+/**
+* Lock a thing lock for read access and call a function with the associated thing. The lock is released when the function returns. Unlike webthing_thing_lock_read, this does not allocate.
+*
+* @param thing pointer to the thing lock
+* @param f function to call with the locked thing (for reading only) and ctx
+* @param ctx pointer passed through to f unchanged
+*/
+void webthing_thing_with_read(webthing_thing_lock* thing, void (*f) (webthing_thing* thing, void* ctx), void* ctx);
 
+/**
+* Lock a thing lock for write access and call a function with the associated thing. The lock is released when the function returns. Unlike webthing_thing_lock_write, this does not allocate.
+*
+* @param thing pointer to the thing lock
+* @param f function to call with the locked thing and ctx
+* @param ctx pointer passed through to f unchanged
+*/
+void webthing_thing_with_write(webthing_thing_lock* thing, void (*f) (webthing_thing* thing, void* ctx), void* ctx);
+
+/**
+* Lock a action lock for read access and call a function with the associated action. The lock is released when the function returns. Unlike webthing_action_lock_read, this does not allocate.
+*
+* @param action pointer to the action lock
+* @param f function to call with the locked action (for reading only) and ctx
+* @param ctx pointer passed through to f unchanged
+*/
+void webthing_action_with_read(webthing_action_lock* action, void (*f) (webthing_action* action, void* ctx), void* ctx);
+
+/**
+* Lock a action lock for write access and call a function with the associated action. The lock is released when the function returns. Unlike webthing_action_lock_write, this does not allocate.
+*
+* @param action pointer to the action lock
+* @param f function to call with the locked action and ctx
+* @param ctx pointer passed through to f unchanged
+*/
+void webthing_action_with_write(webthing_action_lock* action, void (*f) (webthing_action* action, void* ctx), void* ctx);
+
+
+// Metrics functions
+
+/**
+* Get the process wide metrics. Counters only ever increase, so rates are derived from the difference between two snapshots. The lock wait times cover the thing lock functions of this library.
+*
+* @return copy of the current metrics
+*/
+webthing_metrics webthing_metrics_snapshot();
+
+/**
+* Render the process wide metrics in the Prometheus text format, as served at GET /metrics when enabled in the server options. Request rates are exported as webthing_http_requests_total with a route label per route of this library; routes left to the webthing crate, like the JSON websockets of the things passed at start, are not counted.
+*
+* @return metrics as string. Don't forget to call webthing_str_free!
+*/
+char* webthing_metrics_render();
+
+/**
+* Get the latencies of the C callbacks and of the action lifecycle. Use them to spot slow drivers: every callback runs while the server waits for it.
+*
+* @param action_name name of an action type to only get the latencies of those actions, or null for the latencies of all callbacks. set_value is only recorded process wide
+* @return copy of the current latencies. All counts are 0 for an action type that has not been used yet
+*/
+webthing_latencies webthing_metrics_latencies(char* action_name);
 
 // Free functions
 
@@ -822,3 +1702,10 @@ void webthing_thing_lock_free(webthing_thing_lock* thing);
 * @param thing pointer to the action lock to free
 */
 void webthing_action_lock_free(webthing_action_lock* action);
+
+/**
+* Free a property snapshot pointer that was returned from a webthing function. Only call this method once with every such variable, and never call it with a variable you allocated yourself!
+*
+* @param snapshot pointer to the property snapshot to free
+*/
+void webthing_property_snapshot_free(webthing_property_snapshot* snapshot);